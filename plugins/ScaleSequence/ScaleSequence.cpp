@@ -14,8 +14,16 @@
  * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <atomic>
+#include <memory>
+#include <mutex>
+
 #include "DistrhoPlugin.hpp"
-#include "ScaleSequenceControls.hpp"
+#include "ScaleSequenceParameters.hpp"
+#include "ScaleSequenceClock.hpp"
+#include "ScaleSequenceLoader.hpp"
+#include "ScaleSequencePublisher.hpp"
+#include "ScaleSequenceSteps.hpp"
 #include "Tunings.h"
 #include "libMTSMaster.cpp"
 
@@ -31,31 +39,70 @@ class ScaleSequence : public Plugin
 public:
     ScaleSequence()
         : Plugin(kParameterCount, 0, kStateCount),
-          sampleRate(getSampleRate())
+          fCold(new ColdState(getSampleRate()))
     {
-        std::memset(fParameters, 0, sizeof(fParameters));
-        
-        // populate fParameters with defaults
-        for (int32_t i = 0; i < kParameterCount; i++)
-        {
-            fParameters[i] = ParameterDefaults[i];
-        }
+        sampleRateChanged(fCold->sampleRate);
         
-        sampleRateChanged(sampleRate);
-        
-		current_scale = 0;
-        tuning1 = Tunings::Tuning();
-        tuning2 = Tunings::Tuning();
-        tuning3 = Tunings::Tuning();
-        tuning4 = Tunings::Tuning();
-        
-        //Fill frequency arrays with default frequencies from tuning1
+		fHot.current_scale = 0;
+		fHot.step_index = static_cast<int32_t>(ParameterDefaults[kParameterCurrentStep] / 0.0625f) - 1;
+		fHot.pattern = static_cast<int32_t>(ParameterDefaults[kParameterPattern]);
+		fHot.last_bar = 0;
+		fHot.current_multiplier = 1.0;
+		fHot.glide_position = 0;
+		fHot.pitch_segment_end = 0;
+		fHot.current_generation = 0;
+		fHot.remaining = 0.0;
+		fHot.largest_delta = 0.0;
+		fHot.gliding = false;
+		fHot.pitch_glide = false;
+		fHot.glide_in_pitch = false;
+		fHot.held_notes_only = false;
+		fHot.retune_on_note_on = false;
+		fHot.publish_pending = true;
+		fHot.published_valid = false;
+		fHot.has_clients = false;
+		fHot.client_check_countdown = 0;
+		fHot.publish_from_thread = false;
+		fHot.handoff_pending = false;
+		fHot.render_frame = 0;
+		fHot.published_remaining = 0.0;
+		fHot.publish_scale = 0.0;
+		fHot.publish_threshold = ParameterDefaults[kParameterPublishThreshold];
+		fHot.frames_since_publish = 0;
+		fHot.block_events = nullptr;
+		fHot.block_event_count = 0;
+		fHot.next_block_event = 0;
+		fHot.glide_all_notes = true;
+		fHot.glide_note_count = 0;
+		std::memset(fHot.held_notes, 0, sizeof(fHot.held_notes));
+		std::memset(fHot.channel_notes, 0, sizeof(fHot.channel_notes));
+		fHot.scale_glide = 0.0f;
+		fHot.glide_sync_notes = 0.0;
+		fHot.samples_per_note = 0.0;
+		fHot.transport = kTransportIdle;
+		fHot.expected_frame = 0;
+		fHot.internal_samples = 0;
+		fHot.internal_beats = 0.0;
+		fHot.origin_beats = 0.0;
+		fHot.samples_per_beat = 1.0;
+		fHot.clock = 0;
+		fHot.next_boundary_sample = 0;
+		fHot.blocks_since_check = 0;
+		fHot.boundary_stale = true;
+		fHot.warm_start = false;
+		std::memset(&fHot.boundary_inputs, 0, sizeof(fHot.boundary_inputs));
+		
+		resetStepPattern(fCold->liveSteps);
+		stepPatternFromParameters(fCold->liveSteps, ParameterDefaults);
+		compileTransitionPlan(fCold->livePlan, fCold->liveSteps, fHot.sample_rate);
+		updateGlideSettings(ParameterDefaults);
+		selectPlan();
+		fHot.glide = stepTransition(*fHot.plan->at(0));
         
-        for (int32_t i = 0; i < 128; i++)
-        {
-            frequencies_in_hz[i] = tuning1.frequencyForMidiNote(i);;
-            target_frequencies_in_hz[i] = tuning1.frequencyForMidiNote(i);;
-        }
+        // Start from the shared standard tuning, which is only ever computed once per process
+        std::memcpy(fHot.frequencies_in_hz, defaultScaleTable().frequencies, sizeof(fHot.frequencies_in_hz));
+        std::memcpy(fHot.target_frequencies_in_hz, defaultScaleTable().frequencies, sizeof(fHot.target_frequencies_in_hz));
+        std::memset(fHot.glide_delta, 0, sizeof(fHot.glide_delta));
     }
 
 protected:
@@ -331,7 +378,136 @@ protected:
 			parameter.name = "Current Step";
             parameter.symbol = "currentstep";
             parameter.hints = kParameterIsOutput;
+            parameter.ranges.min = controlLimits[index].first;
+            parameter.ranges.max = controlLimits[index].second;
+            parameter.ranges.def = ParameterDefaults[index];
 			break;
+        case kParameterGlideSync:
+            parameter.hints = kParameterIsAutomatable|kParameterIsInteger;
+            parameter.name   = "Glide Sync";
+            parameter.symbol = "glideSync";
+            parameter.enumValues.count = kGlideSyncCount;
+            parameter.enumValues.restrictedMode = true;
+            {
+                ParameterEnumerationValue* const values = new ParameterEnumerationValue[kGlideSyncCount];
+                parameter.enumValues.values = values;
+
+                for (int32_t i = 0; i < kGlideSyncCount; i++)
+                {
+                    values[i].label = kGlideSyncLabels[i];
+                    values[i].value = i;
+                }
+            }
+            parameter.ranges.min = controlLimits[index].first;
+            parameter.ranges.max = controlLimits[index].second;
+            parameter.ranges.def = ParameterDefaults[index];
+            break;
+        case kParameterGlideAhead:
+            parameter.name = "Glide Ahead";
+            parameter.symbol = "glideAhead";
+            parameter.hints = kParameterIsAutomatable|kParameterIsBoolean|kParameterIsInteger;
+            parameter.ranges.min = controlLimits[index].first;
+            parameter.ranges.max = controlLimits[index].second;
+            parameter.ranges.def = ParameterDefaults[index];
+            break;
+        case kParameterClockSource:
+            parameter.hints = kParameterIsAutomatable|kParameterIsInteger;
+            parameter.name   = "Clock Source";
+            parameter.symbol = "clockSource";
+            parameter.enumValues.count = 4;
+            parameter.enumValues.restrictedMode = true;
+            {
+                ParameterEnumerationValue* const values = new ParameterEnumerationValue[4];
+                parameter.enumValues.values = values;
+
+                values[0].label = "Host";
+                values[0].value = kClockHost;
+                values[1].label = "MIDI Clock";
+                values[1].value = kClockMidi;
+                values[2].label = "Internal";
+                values[2].value = kClockInternal;
+                values[3].label = "Internal (Host Frame)";
+                values[3].value = kClockHostFrame;
+            }
+            parameter.ranges.min = controlLimits[index].first;
+            parameter.ranges.max = controlLimits[index].second;
+            parameter.ranges.def = ParameterDefaults[index];
+            break;
+        case kParameterTempo:
+            parameter.hints = kParameterIsAutomatable;
+            parameter.name   = "Tempo";
+            parameter.symbol = "tempo";
+            parameter.unit   = "BPM";
+            parameter.ranges.min = controlLimits[index].first;
+            parameter.ranges.max = controlLimits[index].second;
+            parameter.ranges.def = ParameterDefaults[index];
+            break;
+        case kParameterHeldNotesOnly:
+            parameter.name = "Held Notes Only";
+            parameter.symbol = "heldNotesOnly";
+            parameter.hints = kParameterIsAutomatable|kParameterIsBoolean|kParameterIsInteger;
+            parameter.ranges.min = controlLimits[index].first;
+            parameter.ranges.max = controlLimits[index].second;
+            parameter.ranges.def = ParameterDefaults[index];
+            break;
+        case kParameterRetuneOnNoteOn:
+            parameter.name = "Retune On Note On";
+            parameter.symbol = "retuneOnNoteOn";
+            parameter.hints = kParameterIsAutomatable|kParameterIsBoolean|kParameterIsInteger;
+            parameter.ranges.min = controlLimits[index].first;
+            parameter.ranges.max = controlLimits[index].second;
+            parameter.ranges.def = ParameterDefaults[index];
+            break;
+        case kParameterPublishThreshold:
+            parameter.hints = kParameterIsAutomatable;
+            parameter.name   = "Publish Threshold";
+            parameter.symbol = "publishThreshold";
+            parameter.unit   = "cents";
+            parameter.ranges.min = controlLimits[index].first;
+            parameter.ranges.max = controlLimits[index].second;
+            parameter.ranges.def = ParameterDefaults[index];
+            break;
+        case kParameterPublishFromThread:
+            parameter.name = "Publish From Thread";
+            parameter.symbol = "publishFromThread";
+            parameter.hints = kParameterIsAutomatable|kParameterIsBoolean|kParameterIsInteger;
+            parameter.ranges.min = controlLimits[index].first;
+            parameter.ranges.max = controlLimits[index].second;
+            parameter.ranges.def = ParameterDefaults[index];
+            break;
+        case kParameterPublishLatency:
+            parameter.name = "Publish Latency";
+            parameter.symbol = "publishLatency";
+            parameter.unit = "ms";
+            parameter.hints = kParameterIsOutput;
+            parameter.ranges.min = controlLimits[index].first;
+            parameter.ranges.max = controlLimits[index].second;
+            parameter.ranges.def = ParameterDefaults[index];
+            break;
+        case kParameterSnapOnJump:
+            parameter.name = "Snap On Jump";
+            parameter.symbol = "snapOnJump";
+            parameter.hints = kParameterIsAutomatable|kParameterIsBoolean|kParameterIsInteger;
+            parameter.ranges.min = controlLimits[index].first;
+            parameter.ranges.max = controlLimits[index].second;
+            parameter.ranges.def = ParameterDefaults[index];
+            break;
+        case kParameterPitchGlide:
+            parameter.name = "Pitch Glide";
+            parameter.symbol = "pitchGlide";
+            parameter.hints = kParameterIsAutomatable|kParameterIsBoolean|kParameterIsInteger;
+            parameter.ranges.min = controlLimits[index].first;
+            parameter.ranges.max = controlLimits[index].second;
+            parameter.ranges.def = ParameterDefaults[index];
+            break;
+        case kParameterPattern:
+            parameter.name = "Pattern";
+            parameter.symbol = "pattern";
+            parameter.hints = kParameterIsAutomatable|kParameterIsInteger;
+            parameter.ranges.min = controlLimits[index].first;
+            parameter.ranges.max = controlLimits[index].second;
+            parameter.ranges.def = ParameterDefaults[index];
+            break;
         }
     }
 
@@ -375,9 +551,13 @@ protected:
             state.key = "kbm_file_4";
             state.label = "KBM File 4";
             break;
+        case kStateStepPatterns:
+            state.key = "step_patterns";
+            state.label = "Step Patterns";
+            break;
         }
 
-        state.hints = kStateIsFilenamePath;
+        state.hints = index == kStateStepPatterns ? 0 : kStateIsFilenamePath;
     }
 
    /* --------------------------------------------------------------------------------------------------------
@@ -389,7 +569,7 @@ protected:
     */
     float getParameterValue(uint32_t index) const override
     {
-        return fParameters[index];
+        return fParameters.get(index);
     }
 
    /**
@@ -400,7 +580,7 @@ protected:
     */
     void setParameterValue(uint32_t index, float value) override
     {
-		fParameters[index] = value;
+		fParameters.set(index, value);
 	}
 
    /**
@@ -412,91 +592,102 @@ protected:
 
         /**/ if (std::strcmp(key, "scl_file_1") == 0)
         {
-		    loadScl(tuning1, value);
+		    fCold->slots[0].setSclFile(value);
+		    loadSlot(0);
 		}
         else if (std::strcmp(key, "scl_file_2") == 0)
         {   
-			loadScl(tuning2, value);
+			fCold->slots[1].setSclFile(value);
+			loadSlot(1);
 		}
         else if (std::strcmp(key, "scl_file_3") == 0)
 	    {
-            loadScl(tuning3, value);
+            fCold->slots[2].setSclFile(value);
+            loadSlot(2);
         }
         else if (std::strcmp(key, "scl_file_4") == 0)
 	    {
-            loadScl(tuning4, value);
+            fCold->slots[3].setSclFile(value);
+            loadSlot(3);
         }
         else if (std::strcmp(key, "kbm_file_1") == 0)
 	    {
-            loadKbm(tuning1, value);
+            fCold->slots[0].setKbmFile(value);
+            loadSlot(0);
         }
         else if (std::strcmp(key, "kbm_file_2") == 0)
 	    {
-            loadKbm(tuning2, value);
+            fCold->slots[1].setKbmFile(value);
+            loadSlot(1);
         }
         else if (std::strcmp(key, "kbm_file_3") == 0)
 	    {
-            loadKbm(tuning3, value);
+            fCold->slots[2].setKbmFile(value);
+            loadSlot(2);
         }
         else if (std::strcmp(key, "kbm_file_4") == 0)
 	    {
-            loadKbm(tuning4, value);
+            fCold->slots[3].setKbmFile(value);
+            loadSlot(3);
+        }
+        else if (std::strcmp(key, "step_patterns") == 0)
+        {
+            setStepPatterns(value);
         }
     }
     
-    void loadScl(Tunings::Tuning & tn, const char* value)
+   /**
+      Replace the pattern bank. run() picks the new bank up at its next block, and switches patterns on bar boundaries.
+      Malformed text keeps the previous bank.
+    */
+    void setStepPatterns(const char* value)
     {
-		String filename(value);
-		auto k = tn.keyboardMapping;
-		
-		if (filename.endsWith(".scl"))
-		{
-			try
-			{   auto s = Tunings::readSCLFile(value);
-				tn = Tunings::Tuning(s, k);
-				//d_stdout("ScaleSequence: tuning set to %s", value);
-			}
-			catch (const std::exception& e)
-			{
-				tn = Tunings::Tuning();
-				d_stdout("ScaleSequence:Exception when setting tuning");
-				d_stdout(e.what());
-			}
-		}
-		else
-		{
-			auto s = Tunings::Tuning().scale;
-			tn = Tunings::Tuning(s, k);
-			//d_stdout("ScaleSequence: tuning scl reset");
-		}
-	}
-	
-	void loadKbm(Tunings::Tuning & tn, const char* value)
-	{
-		String filename(value);
-		auto s = tn.scale;
-		if (filename.endsWith(".kbm"))
-		{
-			try
-			{
-				auto k = Tunings::readKBMFile(value);
-				tn = Tunings::Tuning(s, k);
-				//d_stdout("ScaleSequence: tuning set to %s", value);
-			}
-			catch (const std::exception& e)
-			{
-				tn = Tunings::Tuning();
-				d_stdout("ScaleSequence:Exception when setting tuning");
-				d_stdout(e.what());
-			}
-		}
-		else
-		{
-			auto k = Tunings::Tuning().keyboardMapping;
-			tn = Tunings::Tuning(s, k);
-			//d_stdout("ScaleSequence: tuning kbm reset");
-		}
-	}
+        std::lock_guard<std::mutex> lock(fCold->bankMutex);
+        
+        if (! parseStepBank(value, fCold->bank))
+        {
+            d_stdout("ScaleSequence:Ignoring malformed step patterns");
+            return;
+        }
+        
+        compileBank();
+    }
+    
+    // Compile the bank for run() to pick up at its next block. Called with bankMutex held.
+    void compileBank()
+    {
+        compileTransitionPlanBank(fCold->bankPlans.writeBuffer(), fCold->bank, fCold->sampleRate);
+        fCold->bankPlans.publish();
+    }
+    
+   /**
+      Queue a slot on the shared loader pool. Slots that the sequence can reach are loaded first, the rest at low
+      priority. A step that selects a slot which is still waiting will move it to the front of the queue.
+    */
+    void loadSlot(int32_t slot)
+    {
+        fCold->loader.schedule(slot, isSlotReferenced(slot));
+    }
+    
+    // Is the slot used by any step before the loop point, or by any pattern in the bank?
+    bool isSlotReferenced(int32_t slot) const
+    {
+        const int32_t loopPoint = static_cast<int32_t>(fParameters.get(kParameterLoopPoint));
+        
+        for (int32_t i = 0; i < loopPoint; i++)
+        {
+            if (static_cast<int32_t>(fParameters.get(kParameterStep1 + i)) == slot + 1)
+                return true;
+        }
+        
+        for (int32_t i = 0; i < kPatternCount; i++)
+        {
+            if (fCold->bank.patterns[i].references(slot))
+                return true;
+        }
+        
+        return false;
+    }
 
     /* --------------------------------------------------------------------------------------------------------
     * Activate / Deactivate */
@@ -505,11 +696,22 @@ protected:
     {
 	    if (MTS_CanRegisterMaster())
 			MTS_RegisterMaster();
-		current_scale = 0;
+		fHot.midi_clock.reset();
+		fHot.publish_pending = true;
+		fHot.published_valid = false;
+		fHot.has_clients = false;
+		fHot.client_check_countdown = 0;
+		fHot.internal_samples = 0;
+		fHot.internal_beats = 0.0;
+		fHot.publish_from_thread = false;
+		fHot.handoff_pending = false;
+		fCold->publisher.start();
+		warmStart();
 	}
 	
     void deactivate() override
     {
+        fCold->publisher.stop();
         MTS_DeregisterMaster();
     }
     
@@ -522,180 +724,1305 @@ protected:
     */
     void run(const float** inputs, float** outputs, uint32_t frames, const MidiEvent* midiEvents, uint32_t midiEventCount) override
     {
-		int32_t stepIndex = static_cast<int32_t>(fParameters[kParameterCurrentStep] / 0.0625f) -1;
-        int32_t loopPoint = static_cast<int32_t>(fParameters[kParameterLoopPoint]);
+        // One snapshot of the parameters for the whole block
+        float params[kParameterCount];
+        fParameters.snapshot(params);
         
-        // Loop through the MIDI events. We do this whatever the setting, as we will pass them all through to MIDI out
-		for (uint32_t currentMidiEvent = 0; currentMidiEvent < midiEventCount; ++currentMidiEvent)
-		{
-		     if (midiEvents[currentMidiEvent].size <= 3)
-		     {   uint8_t data0 = midiEvents[currentMidiEvent].data[0];
-	             if ( ((data0 & 0xF0) == 0x90) and (fParameters[kParameterMeasure] == 2) ) // Received a Note on, and using MIDI note on to advance step
-                     stepIndex = (stepIndex + 1) % loopPoint;
-			 }
-			 // Pass all MIDI events through
-			 writeMidiEvent(midiEvents[currentMidiEvent]);
-		}
+        // The bank comes compiled. The step parameters are compiled here when they change, which is a single pass
+        // as they have no glide lengths of their own.
+        const bool bankChanged = fCold->bankPlans.acquire();
+        const bool stepsChanged = stepPatternFromParameters(fCold->liveSteps, params);
+        if (stepsChanged)
+            compileTransitionPlan(fCold->livePlan, fCold->liveSteps, fHot.sample_rate);
+        if (bankChanged or stepsChanged)
+            selectPlan();
         
-		if (fParameters[kParameterMeasure] != 2) // Using beats or bars to find step position
-		{
-			stepIndex = 0;
-            const TimePosition& timePos(getTimePosition());
-        
-            double beats_per_bar = timePos.bbt.beatsPerBar;
-            // In DISTRHO DPF, the first bar == 1. But our calculations require first bar == 0
-            double bar = timePos.bbt.bar - 1;
-            // In DISTRHO DPF, the first beat of the bar == 1. Our calculations require first beat of the bar == 0
-            double beat = timePos.bbt.beat - 1;
-            double beatFraction   = timePos.bbt.tick / timePos.bbt.ticksPerBeat;
-            double beatsFromStart = (bar * beats_per_bar) + beat + beatFraction;
-                
-            // Offset. Might cause weirdness at the start of the track. But stepIndex below should be ignored if less than zero.
-            if (fParameters[kParameterMeasure] == 0) // using beats
-                beatsFromStart -= fParameters[kParameterOffset];
-            else if (fParameters[kParameterMeasure] == 1) //using bars
-                bar -= fParameters[kParameterOffset];
-        
-            // Which step are we on?
-            if (fParameters[kParameterMeasure] == 0) // using beats
-                stepIndex = static_cast<int32_t>(std::floor(beatsFromStart / fParameters[kParameterMultiplier])) % loopPoint;
-            else if (fParameters[kParameterMeasure] == 1) // using bars
-                stepIndex = static_cast<int32_t>(std::floor(bar / fParameters[kParameterMultiplier])) % loopPoint;
-		}
+        // Glide Sync and Scale Glide are applied as each glide starts, so a change only retimes the glide under way
+        if (updateGlideSettings(params) and fHot.glide.followsGlide)
+            retimeGlide();
         
-        // Set current step parameter for UI feedback
-        fParameters[kParameterCurrentStep] = static_cast<float>((stepIndex + 1) * 0.0625f);
+        // Without a host transport, beats and bars can follow a MIDI clock or a clock of our own instead
+        const int32_t clockSource = params[kParameterMeasure] != 2 ? static_cast<int32_t>(params[kParameterClockSource])
+                                                                   : kClockHost;
+        const bool midiClock = clockSource == kClockMidi;
+        TimePosition clockPos;
+        if (midiClock)
+            fHot.midi_clock.getTimePosition(clockPos, 0, fHot.sample_rate);
+        else if (clockSource == kClockInternal or clockSource == kClockHostFrame)
+            getInternalTimePosition(clockPos, clockSource == kClockHostFrame, params);
+        
+        // Glides set in notes follow the tempo
+        const TimePosition& timePos(clockSource != kClockHost ? clockPos : getTimePosition());
+        updateTempo(timePos);
+        
+        const int32_t requestedPattern = static_cast<int32_t>(params[kParameterPattern]);
+        
+        // Glides already under way finish in the domain they started in
+        fHot.pitch_glide = params[kParameterPitchGlide] > 0.5f;
+        fHot.held_notes_only = params[kParameterHeldNotesOnly] > 0.5f;
         
-        int32_t stepScale = 0;
+        // With Retune On Note On, the tuning is only published on the frames of this block's note ons
+        const bool retuneOnNoteOn = params[kParameterRetuneOnNoteOn] > 0.5f;
+        if (retuneOnNoteOn and not fHot.retune_on_note_on)
+            fHot.publish_pending = true;
+        fHot.retune_on_note_on = retuneOnNoteOn;
         
-        // What should the scale be for this step?
-        switch (stepIndex)
+        // Otherwise a glide is published when it has moved far enough to hear, or at least every publish_interval frames
+        fHot.publish_threshold = params[kParameterPublishThreshold];
+        
+        // With Publish From Thread, tables are handed to the publisher thread once it has taken over from run()
+        fCold->publisher.setEnabled(params[kParameterPublishFromThread] > 0.5f);
+        const bool fromThread = fCold->publisher.isActive();
+        if (fromThread != fHot.publish_from_thread)
         {
-        case 0:
-            stepScale = static_cast<uint32_t>(fParameters[kParameterStep1]);
-            break;
-        case 1:
-            stepScale = static_cast<uint32_t>(fParameters[kParameterStep2]);
-            break;
-        case 2:
-            stepScale = static_cast<uint32_t>(fParameters[kParameterStep3]);
-            break;
-        case 3:
-            stepScale = static_cast<uint32_t>(fParameters[kParameterStep4]);
-            break;
-        case 4:
-            stepScale = static_cast<uint32_t>(fParameters[kParameterStep5]);
-            break;
-        case 5:
-            stepScale = static_cast<uint32_t>(fParameters[kParameterStep6]);
-            break;
-        case 6:
-            stepScale = static_cast<uint32_t>(fParameters[kParameterStep7]);
-            break;
-        case 7:
-            stepScale = static_cast<uint32_t>(fParameters[kParameterStep8]);
-            break;
-        case 8:
-            stepScale = static_cast<uint32_t>(fParameters[kParameterStep9]);
-            break;
-        case 9:
-            stepScale = static_cast<uint32_t>(fParameters[kParameterStep10]);
-            break;
-        case 10:
-            stepScale = static_cast<uint32_t>(fParameters[kParameterStep11]);
-            break;
-        case 11:
-            stepScale = static_cast<uint32_t>(fParameters[kParameterStep12]);
-            break;
-        case 12:
-            stepScale = static_cast<uint32_t>(fParameters[kParameterStep13]);
-            break;
-        case 13:
-            stepScale = static_cast<uint32_t>(fParameters[kParameterStep14]);
-            break;
-        case 14:
-            stepScale = static_cast<uint32_t>(fParameters[kParameterStep15]);
-            break;
-        case 15:
-            stepScale = static_cast<uint32_t>(fParameters[kParameterStep16]);
-            break;
-        default:
-            break;
-		}
-		
-		// Switch scale if necessary
-		// if stepScale is still 0 it will be ignored, and the tuning won't change
-        if (stepScale != current_scale)
-        {			
-			switch (stepScale)
-			{
-			case 1:
-			{
-				for (int32_t i = 0; i < 128; i++)
-				{
-					target_frequencies_in_hz[i] = tuning1.frequencyForMidiNote(i);
-				}
-				break;
-			}
-			case 2:
-			{
-				for (int32_t i = 0; i < 128; i++)
-				{
-					target_frequencies_in_hz[i] = tuning2.frequencyForMidiNote(i);
-				}
-				break;
-			}
-			case 3:
-			{
-				for (int32_t i = 0; i < 128; i++)
-				{
-					target_frequencies_in_hz[i] = tuning3.frequencyForMidiNote(i);
-				}
-				break;
-			}
-			case 4:
+            fHot.publish_from_thread = fromThread;
+            fHot.published_valid = false;
+            fHot.publish_pending = true;
+        }
+        fHot.render_frame = 0;
+        fHot.block_events = midiEvents;
+        fHot.block_event_count = midiEventCount;
+        fHot.next_block_event = 0;
+        
+        checkClients(frames);
+        
+		// Pick up any tables that have been loaded since the last block
+		bool slotUpdated[kScaleSlotCount] = {};
+		acquireSlots(slotUpdated);
+        
+		if (params[kParameterMeasure] == 2) // Using MIDI note on to advance step
+		{
+			// Catch up with slot loads and plan changes for the step we are on
+			enterStep(fHot.step_index, slotUpdated);
+			fHot.transport = kTransportIdle;
+			fHot.boundary_stale = true;
+			
+			uint32_t frame = 0;
+			
+			// Loop through the MIDI events. We do this whatever the setting, as we will pass them all through to MIDI out
+			for (uint32_t currentMidiEvent = 0; currentMidiEvent < midiEventCount; ++currentMidiEvent)
 			{
-				for (int32_t i = 0; i < 128; i++)
-				{
-					target_frequencies_in_hz[i] = tuning4.frequencyForMidiNote(i);
-				}
-				break;
+			     const MidiEvent& event(midiEvents[currentMidiEvent]);
+			     
+			     if (event.size <= 3 and ((event.data[0] & 0xF0) == 0x90 or (event.data[0] & 0xF0) == 0x80))
+			     {
+			         // Notes start, stop and change the step on their own frame
+			         const uint32_t noteFrame = std::min(event.frame, frames);
+			         renderGlide(noteFrame - std::min(frame, noteFrame));
+			         frame = std::max(frame, noteFrame);
+			     }
+			     
+			     // Every event, so all notes off and all sound off let go of the held notes too
+			     trackNote(event);
+			     
+			     if (event.size <= 3 and (event.data[0] & 0xF0) == 0x90) // Received a Note on
+			     {
+			         int32_t stepIndex = (fHot.step_index + 1) % fHot.plan->length;
+			         
+			         // Without bars, a new pattern starts when the sequence comes back round
+			         if (stepIndex == 0 and requestedPattern != fHot.pattern)
+			             selectPattern(requestedPattern);
+			         
+			         enterStep(stepIndex, nullptr);
+			     }
+				 // Pass all MIDI events through
+				 writeMidiEvent(event);
 			}
-			default:
-                break;
-			}
-	
+			
+			renderGlide(frames - frame);
 		}
-		
-		// Scale glide, continuous tuning. Currently done via division of the remaining difference to target
-		// for every frame
-	        for (uint32_t fr = 0; fr < frames; ++fr)
+		else // Using beats or bars to find step position
 		{
-			for (int32_t i = 0; i < 128; i++)
+			for (uint32_t currentMidiEvent = 0; currentMidiEvent < midiEventCount; ++currentMidiEvent)
 			{
-				double difference = target_frequencies_in_hz[i] - frequencies_in_hz[i];
-				if (std::fabs(difference) < 0.0001f)
-					frequencies_in_hz[i] = target_frequencies_in_hz[i];
-				else
-					frequencies_in_hz[i] = frequencies_in_hz[i] + (difference / (fParameters[kParameterScaleGlide] * 1000.0));
+				trackNote(midiEvents[currentMidiEvent]);
+				writeMidiEvent(midiEvents[currentMidiEvent]);
 			}
-			// Set MTS-ESP Scale
-			MTS_SetNoteTunings(frequencies_in_hz);
+			
+			if (midiClock)
+				followMidiClock(midiEvents, midiEventCount, frames, requestedPattern, params, slotUpdated);
+			else
+				followTransport(timePos, frames, requestedPattern, params, slotUpdated);
 		}
+        
+        // The newest table goes to the publisher thread once per block
+        if (fHot.handoff_pending)
+        {
+            fCold->publisher.write(fHot.frequencies_in_hz, not fHot.published_valid);
+            fHot.published_valid = true;
+            fHot.handoff_pending = false;
+        }
+        fParameters.setOutput(kParameterPublishLatency, fromThread ? fCold->publisher.latencyMs() : 0.0f);
+        
+        // Only the first block after activation can correct the position warmStart() guessed
+        fHot.warm_start = false;
+        
+        // The internal clock runs whichever clock is in use
+        fHot.internal_samples += frames;
+        fHot.internal_beats += frames * params[kParameterTempo] / (60.0 * fHot.sample_rate);
+        
+        // Set current step parameter for UI feedback
+        fParameters.setOutput(kParameterCurrentStep, static_cast<float>((fHot.step_index + 1) * 0.0625f));
     }
     
+   /**
+      Optional callback to inform the plugin about a sample rate change.
+      Glide times are counted in samples, so the bank is compiled again. run() keeps its own copy of the rate,
+      with the intervals worked out from it.
+    */
+    void sampleRateChanged(double newSampleRate) override
+    {
+        std::lock_guard<std::mutex> lock(fCold->bankMutex);
+        
+        fCold->sampleRate = static_cast<float>(newSampleRate);
+        fHot.sample_rate = fCold->sampleRate;
+        fHot.publish_interval = std::max(1u, static_cast<uint32_t>(fHot.sample_rate * kMaxPublishIntervalMs / 1000));
+        fHot.client_check_interval = std::max(1u, static_cast<uint32_t>(fHot.sample_rate * kClientCheckMs / 1000));
+        compileBank();
+    }
 
     // -------------------------------------------------------------------------------------------------------
 
 private:
-    float sampleRate;
-
-    float fParameters[kParameterCount];
-    Tunings::Tuning tuning1, tuning2, tuning3, tuning4;
+    // Fraction of a beat added to positions computed at a boundary frame
+    static constexpr double kBoundaryEpsilon = 1e-9;
+    enum {
+        // Channels held notes are followed on
+        kMidiChannelCount = 16,
+        // Fewest segments the pitch glide splits a glide of known length into
+        kMinPitchSegments = 16,
+        // How far the host position may stray from the sample clock before it counts as a jump
+        kJumpToleranceFrames = 64,
+        // Blocks between checks of the clock against the host's BBT, for hosts that report frames
+        kDriftCheckBlocks = 32,
+        // Longest a glide goes without being published
+        kMaxPublishIntervalMs = 10,
+        // How often to check whether any MTS-ESP clients are connected
+        kClientCheckMs = 250
+    };
+    
+    enum TransportState {
+        // Stopped, without a position from the host, or stepping by MIDI notes
+        kTransportIdle,
+        kTransportPlaying
+    };
+    
+    // The settings the cached next boundary was worked out with
+    struct BoundaryInputs
+    {
+        float measure;
+        float multiplier;
+        float offset;
+        float ahead;
+        float beatsPerBar;
+    };
+    
+   /**
+      Pick up any tables that have been loaded since the last call, setting the flags of @a slotUpdated that changed.
+      The loaders flag which slots have news, so slots that haven't changed are not touched at all.
+    */
+    void acquireSlots(bool* slotUpdated) noexcept
+    {
+        // The loader rebuilds the differences between slots only after a slot has flagged its new table, so the new
+        // set usually lands a block or more after the flag has been cleared. Looking for it is one atomic load.
+        fCold->deltas.acquire();
+        
+        if (fCold->published.load(std::memory_order_relaxed) == 0)
+            return;
+        
+        const uint32_t published = fCold->published.exchange(0, std::memory_order_acquire);
+        for (int32_t i = 0; i < kScaleSlotCount; i++)
+        {
+            if (published & (1u << i))
+                slotUpdated[i] = fCold->slots[i].acquire();
+        }
+    }
+    
+   /**
+      Go straight to the tuning of the step the host is on, without gliding from whatever was left before, and send it
+      to any clients in one go. Beats and bars take the step from the host's position (or the clock source's), MIDI
+      Note steps stay on the step they were on.
+      The host only keeps its position current during run(), so at activation it is usually the one from before the
+      stop or bypass and only a best guess. The first block takes the real position, and if that is another step, it
+      goes straight there too rather than gliding.
+    */
+    void warmStart()
+    {
+        float params[kParameterCount];
+        fParameters.snapshot(params);
+        
+        bool slotUpdated[kScaleSlotCount] = {};
+        acquireSlots(slotUpdated);
+        fCold->bankPlans.acquire();
+        
+        stepPatternFromParameters(fCold->liveSteps, params);
+        compileTransitionPlan(fCold->livePlan, fCold->liveSteps, fHot.sample_rate);
+        updateGlideSettings(params);
+        fHot.pattern = static_cast<int32_t>(params[kParameterPattern]);
+        selectPlan();
+        
+        int32_t stepIndex = fHot.step_index;
+        
+        if (params[kParameterMeasure] != 2)
+        {
+            // The MIDI clock has just been reset, so it has no position until it is running
+            const int32_t clockSource = static_cast<int32_t>(params[kParameterClockSource]);
+            TimePosition clockPos;
+            if (clockSource == kClockMidi)
+                fHot.midi_clock.getTimePosition(clockPos, 0, fHot.sample_rate);
+            else if (clockSource == kClockInternal or clockSource == kClockHostFrame)
+                getInternalTimePosition(clockPos, clockSource == kClockHostFrame, params);
+            
+            const TimePosition& timePos(clockSource != kClockHost ? clockPos : getTimePosition());
+            updateTempo(timePos);
+            
+            const double beats_per_bar = timePos.bbt.beatsPerBar;
+            if (timePos.bbt.valid and timePos.bbt.beatsPerMinute > 0.0 and beats_per_bar > 0.0
+                and timePos.bbt.ticksPerBeat > 0.0)
+            {
+                const double beatsFromStart = beatsAt(timePos);
+                const double samplesPerBeat = 60.0 * fHot.sample_rate / timePos.bbt.beatsPerMinute;
+                
+                stepIndex = timePos.playing and params[kParameterGlideAhead] > 0.5f
+                            ? stepAhead(beatsFromStart, beats_per_bar, samplesPerBeat, params)
+                            : stepAt(beatsFromStart, std::floor(beatsFromStart / beats_per_bar), params);
+                fHot.last_bar = timePos.bbt.bar;
+            }
+        }
+        
+        // Whatever the tables were before, the step's tuning is set again from scratch
+        fHot.current_scale = 0;
+        enterStep(stepIndex, slotUpdated);
+        snapGlide();
+        
+        fHot.transport = kTransportIdle;
+        fHot.boundary_stale = true;
+        fHot.warm_start = true;
+        
+        checkClients(0);
+        if (fHot.has_clients)
+        {
+            publishTuning();
+            fHot.published_remaining = 0.0;
+            fHot.frames_since_publish = 0;
+            fHot.publish_pending = false;
+        }
+    }
+    
+    // Pattern 0, and any pattern left empty in the bank, plays the step parameters
+    void selectPlan()
+    {
+        fHot.plan = &fCold->livePlan;
+        
+        if (fHot.pattern >= 1 and fHot.pattern <= kPatternCount)
+        {
+            const TransitionPlan& plan(fCold->bankPlans.readBuffer().plans[fHot.pattern - 1]);
+            if (plan.length != 0)
+                fHot.plan = &plan;
+        }
+        
+        fHot.boundary_stale = true;
+        retimeGlide();
+    }
+    
+    void selectPattern(int32_t pattern)
+    {
+        fHot.pattern = pattern;
+        selectPlan();
+    }
+    
+    // Returns true if Scale Glide or Glide Sync has changed
+    bool updateGlideSettings(const float* params) noexcept
+    {
+        const int32_t sync = static_cast<int32_t>(limit(params[kParameterGlideSync], 0.0f, kGlideSyncCount - 1.0f));
+        if (params[kParameterScaleGlide] == fHot.scale_glide and kGlideSyncNotes[sync] == fHot.glide_sync_notes)
+            return false;
+        
+        fHot.scale_glide = params[kParameterScaleGlide];
+        fHot.glide_sync_notes = kGlideSyncNotes[sync];
+        fHot.boundary_stale = true;
+        return true;
+    }
+    
+    // The step's transition with the glide settings applied, as it would start now
+    Transition stepTransition(const Transition& planned) const noexcept
+    {
+        Transition transition(planned);
+        followGlideSettings(transition, fHot.scale_glide, fHot.glide_sync_notes);
+        return transition;
+    }
+    
+    // A glide that is under way follows the new settings of its step
+    void retimeGlide()
+    {
+        const Transition* const planned = fHot.plan->at(fHot.step_index);
+        if (planned == nullptr or planned->scale != fHot.current_scale)
+            return;
+        
+        const Transition transition(stepTransition(*planned));
+        fHot.glide.curve = transition.curve;
+        fHot.glide.notes = transition.notes;
+        fHot.glide.samples = transition.samples;
+        fHot.glide.coefficient = transition.coefficient;
+        fHot.glide.followsGlide = transition.followsGlide;
+        
+        if (fHot.glide.notes > 0.0)
+            timeTransition(fHot.glide, fHot.glide.notes * fHot.samples_per_note);
+        fHot.pitch_segment_end = 0;
+    }
+    
+   /**
+      Work out the length of a whole note from the host tempo and time signature, or 120 BPM in 4/4 without them.
+      Only a glide set in notes that is under way needs updating when the tempo changes: it keeps its progress.
+    */
+    void updateTempo(const TimePosition& timePos)
+    {
+        const bool valid = timePos.bbt.valid and timePos.bbt.beatsPerMinute > 0.0 and timePos.bbt.beatType > 0.0f;
+        const double beatsPerMinute = valid ? timePos.bbt.beatsPerMinute : 120.0;
+        const double beatType = valid ? timePos.bbt.beatType : 4.0;
+        const double samplesPerNote = 60.0 * fHot.sample_rate / beatsPerMinute * beatType;
+        
+        if (samplesPerNote == fHot.samples_per_note)
+            return;
+        fHot.samples_per_note = samplesPerNote;
+        fHot.boundary_stale = true;
+        
+        if (not fHot.gliding or fHot.glide.notes <= 0.0)
+            return;
+        
+        const double previousSamples = fHot.glide.samples;
+        timeTransition(fHot.glide, fHot.glide.notes * samplesPerNote);
+        
+        if (fHot.glide.curve != kCurveExponential)
+            fHot.glide_position = static_cast<uint32_t>(fHot.glide_position * (fHot.glide.samples / previousSamples));
+        fHot.pitch_segment_end = 0;
+    }
+    
+   /**
+      Step through the sequence by the host's beats or bars.
+      While stopped, or without a position from the host, nothing moves unless the host locates somewhere else.
+      While playing, a sample clock counts on from the last position taken from the host, and the next boundary is kept
+      as a sample on that clock, so a block without a boundary costs one integer compare.
+      The position is only taken from the host's bars, beats and ticks again after a jump, such as a loop wrapping round,
+      when it has drifted from the clock, or when a setting the boundaries depend on has changed. A jump moves to the
+      right step straight away and, with Snap On Jump, skips its glide.
+    */
+    void followTransport(const TimePosition& timePos, uint32_t frames, int32_t requestedPattern, const float* params,
+                         const bool* slotUpdated)
+    {
+        const double beats_per_bar = timePos.bbt.beatsPerBar;
+        const bool valid = timePos.bbt.valid and timePos.bbt.beatsPerMinute > 0.0 and beats_per_bar > 0.0
+                           and timePos.bbt.ticksPerBeat > 0.0;
+        
+        if (not valid)
+        {
+            // No position to follow, so stay on the current step
+            if (requestedPattern != fHot.pattern)
+                selectPattern(requestedPattern);
+            enterStep(fHot.step_index, slotUpdated);
+            renderGlide(frames);
+            fHot.transport = kTransportIdle;
+            return;
+        }
+        
+        const bool playing = timePos.playing;
+        
+        // With Glide Ahead, each step starts gliding early enough to arrive on its boundary
+        const bool ahead = playing and params[kParameterGlideAhead] > 0.5f;
+        
+        // Switch patterns when a new bar starts, or straight away while the transport is stopped
+        if (requestedPattern != fHot.pattern and (timePos.bbt.bar != fHot.last_bar or not playing))
+            selectPattern(requestedPattern);
+        fHot.last_bar = timePos.bbt.bar;
+        
+        // Hosts that count frames give jumps away for free. Drift, and hosts that don't, need the position from BBT.
+        bool moved = timePos.frame != 0 and timePos.frame != fHot.expected_frame;
+        if (not moved and (timePos.frame == 0 or ++fHot.blocks_since_check >= kDriftCheckBlocks))
+        {
+            const double clockBeats = fHot.origin_beats + fHot.clock / fHot.samples_per_beat;
+            moved = std::fabs(beatsAt(timePos) - clockBeats) * fHot.samples_per_beat > kJumpToleranceFrames;
+            fHot.blocks_since_check = 0;
+        }
+        
+        const bool jump = playing and fHot.transport == kTransportPlaying and moved;
+        
+        const BoundaryInputs inputs = {
+            params[kParameterMeasure], params[kParameterMultiplier], params[kParameterOffset],
+            ahead ? 1.0f : 0.0f, timePos.bbt.beatsPerBar
+        };
+        const bool resync = moved or fHot.boundary_stale or fHot.transport != (playing ? kTransportPlaying : kTransportIdle)
+                            or std::memcmp(&inputs, &fHot.boundary_inputs, sizeof(inputs)) != 0;
+        
+        if (resync)
+        {
+            const double beatsFromStart = beatsAt(timePos);
+            
+            fHot.origin_beats = beatsFromStart;
+            fHot.samples_per_beat = 60.0 * fHot.sample_rate / timePos.bbt.beatsPerMinute;
+            fHot.clock = 0;
+            fHot.blocks_since_check = 0;
+            
+            enterStep(ahead ? stepAhead(beatsFromStart, beats_per_bar, fHot.samples_per_beat, params)
+                            : stepAt(beatsFromStart, std::floor(beatsFromStart / beats_per_bar), params), slotUpdated);
+            
+            if ((jump and params[kParameterSnapOnJump] > 0.5f) or fHot.warm_start)
+                snapGlide();
+            fHot.warm_start = false;
+            
+            scheduleBoundary(beatsFromStart, beats_per_bar, ahead, params);
+            fHot.boundary_inputs = inputs;
+            fHot.boundary_stale = false;
+        }
+        else
+        {
+            // Catch up with slot loads for the step we are on
+            enterStep(fHot.step_index, slotUpdated);
+        }
+        
+        fHot.transport = playing ? kTransportPlaying : kTransportIdle;
+        fHot.expected_frame = playing ? timePos.frame + frames : timePos.frame;
+        
+        if (not playing)
+        {
+            renderGlide(frames);
+            return;
+        }
+        
+        // Steps and bars that start inside the block take effect on their own frame
+        uint32_t frame = 0;
+        
+        while (fHot.next_boundary_sample < fHot.clock + frames)
+        {
+            const uint32_t boundaryFrame = static_cast<uint32_t>(fHot.next_boundary_sample - fHot.clock);
+            renderGlide(boundaryFrame - frame);
+            frame = boundaryFrame;
+            
+            // Nudge the position past any rounding, so the new step and bar are seen
+            const double reached = fHot.origin_beats + fHot.next_boundary_sample / fHot.samples_per_beat
+                                   + kBoundaryEpsilon;
+            const double reachedBar = std::floor(reached / beats_per_bar);
+            
+            if (reachedBar + 1 != fHot.last_bar and requestedPattern != fHot.pattern)
+                selectPattern(requestedPattern);
+            fHot.last_bar = static_cast<int32_t>(reachedBar) + 1;
+            
+            enterStep(ahead ? stepAhead(reached, beats_per_bar, fHot.samples_per_beat, params)
+                            : stepAt(reached, reachedBar, params), nullptr);
+            
+            scheduleBoundary(reached, beats_per_bar, ahead, params);
+            fHot.boundary_stale = false;
+        }
+        
+        renderGlide(frames - frame);
+        fHot.clock += frames;
+    }
+    
+   /**
+      The internal clock's transport at the start of the block, at the Tempo parameter.
+      It counts on from activate() by itself, or with @a followHost takes its position from the host's frame.
+      Either way the frame is passed on, so steps are scheduled on the sample clock whatever the block size.
+    */
+    void getInternalTimePosition(TimePosition& clockPos, bool followHost, const float* params)
+    {
+        const double beatsPerMinute = params[kParameterTempo];
+        
+        if (followHost)
+        {
+            const TimePosition& hostPos(getTimePosition());
+            const double beats = hostPos.frame * beatsPerMinute / (60.0 * fHot.sample_rate);
+            
+            setClockTimePosition(clockPos, beats, beatsPerMinute, hostPos.playing);
+            clockPos.frame = hostPos.frame;
+            return;
+        }
+        
+        setClockTimePosition(clockPos, fHot.internal_beats, beatsPerMinute, true);
+        clockPos.frame = fHot.internal_samples;
+    }
+    
+   /**
+      Step through the sequence by the MIDI clock in @a midiEvents.
+      The block is split at start, stop, continue and song position messages, and each part follows the transport the
+      clock had at its start. Clock ticks only steer the clock's tempo and phase for the parts after them.
+    */
+    void followMidiClock(const MidiEvent* midiEvents, uint32_t midiEventCount, uint32_t frames, int32_t requestedPattern,
+                         const float* params, const bool* slotUpdated)
+    {
+        uint32_t frame = 0;
+        uint32_t currentMidiEvent = 0;
+        
+        for (;;)
+        {
+            TimePosition clockPos;
+            fHot.midi_clock.getTimePosition(clockPos, frame, fHot.sample_rate);
+            
+            uint32_t end = frames;
+            for (; currentMidiEvent < midiEventCount; ++currentMidiEvent)
+            {
+                const MidiEvent& event(midiEvents[currentMidiEvent]);
+                const uint32_t eventFrame = std::max(frame, std::min(event.frame, frames));
+                
+                if (MidiClock::isTransportMessage(event.data, event.size))
+                {
+                    end = eventFrame;
+                    break;
+                }
+                
+                fHot.midi_clock.process(event.data, event.size, eventFrame);
+            }
+            
+            followTransport(clockPos, end - frame, requestedPattern, params, slotUpdated);
+            slotUpdated = nullptr;
+            frame = end;
+            
+            if (currentMidiEvent == midiEventCount)
+                break;
+            
+            const MidiEvent& event(midiEvents[currentMidiEvent++]);
+            fHot.midi_clock.process(event.data, event.size, frame);
+        }
+        
+        fHot.midi_clock.advance(frames);
+    }
+    
+    // Put the next step, bar or glide start after @a beatsFromStart on the clock, at least one sample on from now
+    void scheduleBoundary(double beatsFromStart, double beats_per_bar, bool ahead, const float* params)
+    {
+        const double boundary = nextEvent(beatsFromStart, beats_per_bar, fHot.samples_per_beat, ahead, params);
+        const double now = (beatsFromStart - fHot.origin_beats) * fHot.samples_per_beat;
+        const double until = std::max(1.0, std::ceil((boundary - beatsFromStart) * fHot.samples_per_beat));
+        
+        fHot.next_boundary_sample = static_cast<int64_t>(std::floor(now + kBoundaryEpsilon)) + static_cast<int64_t>(until);
+    }
+    
+    static double beatsAt(const TimePosition& timePos) noexcept
+    {
+        const double beats_per_bar = timePos.bbt.beatsPerBar;
+        // In DISTRHO DPF, the first bar == 1. But our calculations require first bar == 0
+        const double bar = timePos.bbt.bar - 1;
+        // In DISTRHO DPF, the first beat of the bar == 1. Our calculations require first beat of the bar == 0
+        const double beat = timePos.bbt.beat - 1;
+        const double beatFraction   = timePos.bbt.tick / timePos.bbt.ticksPerBeat;
+        return (bar * beats_per_bar) + beat + beatFraction;
+    }
+    
+    // Position in beats of the next step, bar or (with Glide Ahead) glide start after @a beatsFromStart
+    double nextEvent(double beatsFromStart, double beats_per_bar, double samplesPerBeat, bool ahead,
+                     const float* params) const
+    {
+        const double boundary = nextBoundary(beatsFromStart, beats_per_bar, params);
+        
+        if (not ahead)
+            return boundary;
+        
+        return std::min(boundary, nextGlideStart(beatsFromStart, beats_per_bar, samplesPerBeat, params));
+    }
+    
+    // Which step is playing at @a beatsFromStart, in @a bar? Negative before the offset, meaning no step.
+    int32_t stepAt(double beatsFromStart, double bar, const float* params) const
+    {
+        // Offset. Might cause weirdness at the start of the track. But stepIndex below should be ignored if less than zero.
+        if (params[kParameterMeasure] == 0) // using beats
+            return static_cast<int32_t>(std::floor((beatsFromStart - params[kParameterOffset]) / params[kParameterMultiplier])) % fHot.plan->length;
+        
+        // using bars
+        return static_cast<int32_t>(std::floor((bar - params[kParameterOffset]) / params[kParameterMultiplier])) % fHot.plan->length;
+    }
+    
+    // Position in beats of the next step or bar start after @a beatsFromStart
+    double nextBoundary(double beatsFromStart, double beats_per_bar, const float* params) const
+    {
+        const double nextBar = (std::floor(beatsFromStart / beats_per_bar) + 1.0) * beats_per_bar;
+        
+        if (params[kParameterMeasure] != 0) // using bars, steps only change with the bar
+            return nextBar;
+        
+        const double multiplier = params[kParameterMultiplier];
+        const double step = std::floor((beatsFromStart - params[kParameterOffset]) / multiplier);
+        return std::min(nextBar, (step + 1.0) * multiplier + params[kParameterOffset]);
+    }
+    
+    // Position in beats where the step after the one playing at @a beatsFromStart starts
+    double nextStepStart(double beatsFromStart, double beats_per_bar, const float* params) const
+    {
+        const double multiplier = params[kParameterMultiplier];
+        const double offset = params[kParameterOffset];
+        
+        if (params[kParameterMeasure] == 0) // using beats
+            return (std::floor((beatsFromStart - offset) / multiplier) + 1.0) * multiplier + offset;
+        
+        // using bars, where a step can only start with a bar
+        const double bar = std::floor(beatsFromStart / beats_per_bar);
+        return std::ceil((std::floor((bar - offset) / multiplier) + 1.0) * multiplier + offset) * beats_per_bar;
+    }
+    
+   /**
+      How many beats before its boundary the glide to @a stepIndex has to start to arrive on it.
+      Open-ended glides count as arrived after five time constants. The lead is kept within half a step, so the step
+      before still gets to sound.
+    */
+    double glideLead(int32_t stepIndex, double beats_per_bar, double samplesPerBeat, const float* params) const
+    {
+        const Transition* const planned = fHot.plan->at(stepIndex);
+        if (planned == nullptr)
+            return 0.0;
+        
+        const Transition transition(stepTransition(*planned));
+        double samples = transition.samples;
+        if (transition.notes > 0.0)
+            samples = transition.notes * fHot.samples_per_note;
+        else if (samples == 0.0)
+            samples = 5.0 / transition.coefficient;
+        
+        const double stepBeats = params[kParameterMultiplier] * (params[kParameterMeasure] == 0 ? 1.0 : beats_per_bar);
+        return std::min(samples / samplesPerBeat, 0.5 * stepBeats);
+    }
+    
+    // The step that is playing or, inside the lead of the next step, the one that is being glided to
+    int32_t stepAhead(double beatsFromStart, double beats_per_bar, double samplesPerBeat, const float* params) const
+    {
+        const double start = nextStepStart(beatsFromStart, beats_per_bar, params);
+        const double startBar = std::floor((start + kBoundaryEpsilon) / beats_per_bar);
+        const int32_t next = stepAt(start + kBoundaryEpsilon, startBar, params);
+        
+        if (start - beatsFromStart <= glideLead(next, beats_per_bar, samplesPerBeat, params))
+            return next;
+        
+        return stepAt(beatsFromStart, std::floor(beatsFromStart / beats_per_bar), params);
+    }
+    
+    // Position in beats where the glide to the next step has to start, or that step's start if it already has
+    double nextGlideStart(double beatsFromStart, double beats_per_bar, double samplesPerBeat, const float* params) const
+    {
+        const double start = nextStepStart(beatsFromStart, beats_per_bar, params);
+        const double startBar = std::floor((start + kBoundaryEpsilon) / beats_per_bar);
+        const int32_t next = stepAt(start + kBoundaryEpsilon, startBar, params);
+        const double glideStart = start - glideLead(next, beats_per_bar, samplesPerBeat, params);
+        
+        return glideStart > beatsFromStart ? glideStart : start;
+    }
+    
+   /**
+      Move to @a stepIndex and start gliding to its tuning, unless it is already the target.
+      @a slotUpdated forces a new glide if the step's slot has just been reloaded.
+    */
+    void enterStep(int32_t stepIndex, const bool* slotUpdated)
+    {
+        fHot.step_index = stepIndex;
+        
+        // if the step has no scale it will be ignored, and the tuning won't change
+        const Transition* const transition = fHot.plan->at(stepIndex);
+        if (transition == nullptr or transition->scale < 1 or transition->scale > kScaleSlotCount)
+            return;
+        
+        ScaleSlot& slot(fCold->slots[transition->scale - 1]);
+        
+        // A slot that hasn't been loaded yet keeps the previous target until its table arrives
+        if (slot.isDirty())
+        {
+            slot.request();
+            return;
+        }
+        
+        if (transition->scale != fHot.current_scale or transition->multiplier != fHot.current_multiplier
+            or (slotUpdated != nullptr and slotUpdated[transition->scale - 1]))
+        {
+            startGlide(*transition, slot.table());
+        }
+    }
+    
+   /**
+      Glide from where the tuning is now to @a table, in Hz or, with Pitch Glide on, in octaves.
+      If the last glide has arrived, the difference between the two slots is usually already in the delta set built by
+      the loader, and is copied rather than worked out here.
+    */
+    void startGlide(const Transition& transition, const ScaleTable& table)
+    {
+        const int32_t from = fHot.current_scale - 1;
+        const int32_t to = transition.scale - 1;
+        const double multiplier = transition.multiplier;
+        const DeltaSet& deltas(fCold->deltas.current());
+        
+        fHot.glide_in_pitch = fHot.pitch_glide;
+        
+        const bool settled = not fHot.gliding and from >= 0 and from != to and fHot.current_multiplier == multiplier
+                             and deltas.matches(from, fHot.current_generation, to, table.generation);
+        const int32_t pair = settled ? DeltaSet::pairIndex(from, to) : 0;
+        
+        for (int32_t i = 0; i < kMidiNoteCount; i++)
+            fHot.target_frequencies_in_hz[i] = table.frequencies[i] * multiplier;
+        
+        if (fHot.glide_in_pitch)
+        {
+            // The multiplier is a constant in log2, so it cancels out of the stored differences
+            const double log2Multiplier = std::log2(multiplier);
+            for (int32_t i = 0; i < kMidiNoteCount; i++)
+                fHot.log2_target[i] = table.log2Frequencies[i] + log2Multiplier;
+            
+            if (settled)
+            {
+                std::memcpy(fHot.glide_delta, deltas.log2[pair], sizeof(fHot.glide_delta));
+                fHot.largest_delta = deltas.largestLog2[pair];
+            }
+            else
+            {
+                double largest = 0.0;
+                for (int32_t i = 0; i < kMidiNoteCount; i++)
+                {
+                    fHot.glide_delta[i] = fHot.log2_target[i] - std::log2(fHot.frequencies_in_hz[i]);
+                    largest = std::fmax(largest, std::fabs(fHot.glide_delta[i]));
+                }
+                fHot.largest_delta = largest;
+            }
+        }
+        else if (settled)
+        {
+            for (int32_t i = 0; i < kMidiNoteCount; i++)
+                fHot.glide_delta[i] = deltas.hz[pair][i] * multiplier;
+            fHot.largest_delta = deltas.largest[pair] * multiplier;
+        }
+        else
+        {
+            double largest = 0.0;
+            for (int32_t i = 0; i < kMidiNoteCount; i++)
+            {
+                fHot.glide_delta[i] = fHot.target_frequencies_in_hz[i] - fHot.frequencies_in_hz[i];
+                largest = std::fmax(largest, std::fabs(fHot.glide_delta[i]));
+            }
+            fHot.largest_delta = largest;
+        }
+        
+        // The most cents any note can move for each unit of the remaining fraction, so the publisher can tell how far
+        // the tuning has moved since it was last sent without looking at every note
+        if (fHot.glide_in_pitch)
+        {
+            fHot.publish_scale = 1200.0 * fHot.largest_delta;
+        }
+        else
+        {
+            // A note in Hz moves fastest in cents at the lower of its two ends
+            const double centsPerRatio = 1200.0 / std::log(2.0);
+            double relative = 0.0;
+            for (int32_t i = 0; i < kMidiNoteCount; i++)
+                relative = std::fmax(relative, std::fabs(fHot.glide_delta[i])
+                                               / std::fmin(fHot.frequencies_in_hz[i], fHot.target_frequencies_in_hz[i]));
+            fHot.publish_scale = centsPerRatio * relative;
+        }
+        fHot.published_remaining = 1.0;
+        
+        fHot.glide = stepTransition(transition);
+        fHot.glide_position = 0;
+        fHot.pitch_segment_end = 0;
+        
+        if (fHot.glide.notes > 0.0)
+            timeTransition(fHot.glide, fHot.glide.notes * fHot.samples_per_note);
+        fHot.remaining = 1.0;
+        fHot.gliding = true;
+        fHot.current_scale = transition.scale;
+        fHot.current_multiplier = multiplier;
+        fHot.current_generation = table.generation;
+        fHot.publish_pending = true;
+        
+        // With Held Notes Only, notes that aren't sounding go straight to the target and only the held ones glide
+        fHot.glide_all_notes = not fHot.held_notes_only;
+        if (fHot.glide_all_notes)
+            return;
+        
+        fHot.glide_note_count = 0;
+        for (int32_t i = 0; i < kMidiNoteCount; i++)
+        {
+            if (isHeld(i))
+                fHot.glide_notes[fHot.glide_note_count++] = static_cast<uint8_t>(i);
+            else
+                fHot.frequencies_in_hz[i] = fHot.target_frequencies_in_hz[i];
+        }
+        
+        if (fHot.glide_note_count == 0)
+            fHot.gliding = false;
+    }
+    
+    bool isHeld(int32_t note) const noexcept
+    {
+        return (fHot.held_notes[note >> 6] >> (note & 63)) & 1u;
+    }
+    
+   /**
+      Follow which notes are held from the note on and off messages coming in. Each channel is followed on its own,
+      so a note off only lets go of the key on its own channel, and the note is released once no channel holds it.
+    */
+    void trackNote(const MidiEvent& event) noexcept
+    {
+        if (event.size > 3)
+            return;
+        
+        const uint8_t status = event.data[0] & 0xF0;
+        const uint8_t channel = event.data[0] & 0x0F;
+        const uint8_t note = event.data[1] & 0x7F;
+        const uint64_t bit = uint64_t(1) << (note & 63);
+        
+        if (status == 0x90 and event.data[2] != 0)
+        {
+            fHot.channel_notes[channel][note >> 6] |= bit;
+            fHot.held_notes[note >> 6] |= bit;
+        }
+        else if (status == 0x80 or status == 0x90)
+        {
+            fHot.channel_notes[channel][note >> 6] &= ~bit;
+            
+            for (int32_t c = 0; c < kMidiChannelCount; c++)
+                if (fHot.channel_notes[c][note >> 6] & bit)
+                    return;
+            
+            fHot.held_notes[note >> 6] &= ~bit;
+            releaseNote(note);
+        }
+        else if (status == 0xB0 and (event.data[1] == 120 or event.data[1] == 123)) // All sound off, all notes off
+        {
+            fHot.channel_notes[channel][0] = fHot.channel_notes[channel][1] = 0;
+            
+            fHot.held_notes[0] = fHot.held_notes[1] = 0;
+            for (int32_t c = 0; c < kMidiChannelCount; c++)
+            {
+                fHot.held_notes[0] |= fHot.channel_notes[c][0];
+                fHot.held_notes[1] |= fHot.channel_notes[c][1];
+            }
+            
+            for (int32_t i = fHot.glide_note_count; --i >= 0;)
+                if (not isHeld(fHot.glide_notes[i]))
+                    releaseNote(fHot.glide_notes[i]);
+        }
+    }
+    
+    // A note let go during a glide of held notes stops gliding and goes straight to the target
+    void releaseNote(uint8_t note) noexcept
+    {
+        if (not fHot.gliding or fHot.glide_all_notes)
+            return;
+        
+        for (int32_t i = 0; i < fHot.glide_note_count; i++)
+        {
+            if (fHot.glide_notes[i] != note)
+                continue;
+            
+            fHot.frequencies_in_hz[note] = fHot.target_frequencies_in_hz[note];
+            fHot.glide_notes[i] = fHot.glide_notes[--fHot.glide_note_count];
+            fHot.publish_pending = true;
+            
+            if (fHot.glide_note_count == 0)
+                fHot.gliding = false;
+            return;
+        }
+    }
+    
+   /**
+      Retune On Note On, for the next @a count frames. Steps go straight to their tuning without gliding, and the new
+      tuning is published once, on the frame of the next note on, so nothing is sent while notes are only sustained.
+    */
+    void publishAtNoteOns(uint32_t count)
+    {
+        if (fHot.gliding)
+        {
+            snapGlide();
+            fHot.publish_pending = true;
+        }
+        
+        // Clients that have never been sent anything get the tuning at once rather than at the next note
+        if (not fHot.published_valid)
+        {
+            publishTuning();
+            fHot.publish_pending = false;
+        }
+        
+        const uint32_t end = fHot.render_frame + count;
+        
+        for (; fHot.next_block_event < fHot.block_event_count; ++fHot.next_block_event)
+        {
+            const MidiEvent& event(fHot.block_events[fHot.next_block_event]);
+            
+            if (event.frame >= end)
+                break;
+            
+            const bool noteOn = event.size <= 3 and (event.data[0] & 0xF0) == 0x90 and event.data[2] != 0;
+            if (noteOn and fHot.publish_pending)
+            {
+                publishTuning();
+                fHot.publish_pending = false;
+            }
+        }
+        
+        fHot.render_frame = end;
+    }
+    
+    // Jump straight to the target of the glide under way
+    void snapGlide() noexcept
+    {
+        if (not fHot.gliding)
+            return;
+        
+        std::memcpy(fHot.frequencies_in_hz, fHot.target_frequencies_in_hz, sizeof(fHot.frequencies_in_hz));
+        fHot.remaining = 0.0;
+        fHot.gliding = false;
+        fHot.publish_pending = true;
+    }
+    
+   /**
+      Every so often, see whether any synth is listening. Clients come and go rarely, so this is checked a few times a
+      second rather than every block. One that has just connected is sent the whole table on the next frame.
+    */
+    void checkClients(uint32_t frames) noexcept
+    {
+        if (fHot.client_check_countdown > frames)
+        {
+            fHot.client_check_countdown -= frames;
+            return;
+        }
+        
+        fHot.client_check_countdown = fHot.client_check_interval;
+        
+        const bool hadClients = fHot.has_clients;
+        fHot.has_clients = MTS_GetNumClients() > 0;
+        
+        if (fHot.has_clients and not hadClients)
+        {
+            fHot.published_valid = false;
+            fHot.publish_pending = true;
+        }
+    }
+    
+    // Scale glide, continuous tuning, for the next @a count frames
+    void renderGlide(uint32_t count)
+    {
+        // With nobody listening, glides go straight to their target and nothing is sent until a client connects
+        if (not fHot.has_clients)
+        {
+            if (fHot.gliding)
+                snapGlide();
+            fHot.render_frame += count;
+            return;
+        }
+        
+        if (fHot.retune_on_note_on)
+        {
+            publishAtNoteOns(count);
+            return;
+        }
+        
+        fHot.render_frame += count;
+        
+        for (uint32_t fr = 0; fr < count; ++fr)
+        {
+            if (fHot.gliding)
+                advanceGlide();
+            
+            // Set MTS-ESP Scale
+            if (shouldPublish())
+            {
+                publishTuning();
+                fHot.published_remaining = fHot.gliding ? fHot.remaining : 0.0;
+                fHot.frames_since_publish = 0;
+                fHot.publish_pending = false;
+            }
+            else
+            {
+                ++fHot.frames_since_publish;
+            }
+        }
+    }
+    
+   /**
+      Send the notes that have changed since the last time. With the publisher thread in charge, the table is only
+      marked to be handed over at the end of the block, as the thread sends no more than the newest one anyway.
+    */
+    void publishTuning() noexcept
+    {
+        if (fHot.publish_from_thread)
+            fHot.handoff_pending = true;
+        else
+            sendTuning(fHot.frequencies_in_hz, fHot.published_hz, fHot.published_valid);
+    }
+    
+   /**
+      Whether the tuning has to be sent this frame. Changes outside a glide, and the end of a glide, always are.
+      During a glide, the furthest any note has moved since the last time is worked out from the remaining fraction,
+      and the tuning is sent once that reaches the threshold in cents, or when the longest interval is up.
+    */
+    bool shouldPublish() const noexcept
+    {
+        if (fHot.publish_pending)
+            return true;
+        
+        if (not fHot.gliding)
+            return false;
+        
+        const double cents = (fHot.published_remaining - fHot.remaining) * fHot.publish_scale;
+        return cents >= fHot.publish_threshold or fHot.frames_since_publish + 1 >= fHot.publish_interval;
+    }
+    
+   /**
+      Every curve is the target minus the starting difference times a remaining fraction that falls from 1 to 0,
+      so each note costs one multiply-add whatever the curve.
+    */
+    void advanceGlide()
+    {
+        const Transition& glide(fHot.glide);
+        double remaining;
+        
+        if (fHot.glide_position != UINT32_MAX)
+            ++fHot.glide_position;
+        
+        if (glide.samples != 0 and fHot.glide_position >= glide.samples)
+            remaining = 0.0;
+        else if (glide.curve == kCurveExponential)
+            // Move by a fraction of the remaining difference to target every frame
+            remaining = fHot.remaining * (1.0 - glide.coefficient);
+        else
+            remaining = curveRemaining(glide, fHot.glide_position);
+        
+        const double previous = fHot.remaining;
+        fHot.remaining = remaining;
+        
+        // A glide has arrived once no note is further than 0.0001 Hz, or about 0.0001 cent, from its target
+        const double arrived = fHot.glide_in_pitch ? 1e-7 : 0.0001;
+        
+        if (remaining * fHot.largest_delta < arrived)
+        {
+            // Always sent, so clients end up with the exact target
+            std::memcpy(fHot.frequencies_in_hz, fHot.target_frequencies_in_hz, sizeof(fHot.frequencies_in_hz));
+            fHot.gliding = false;
+            fHot.publish_pending = true;
+            return;
+        }
+        
+        if (fHot.glide_in_pitch)
+        {
+            advancePitchGlide(previous, remaining);
+            return;
+        }
+        
+        if (fHot.glide_all_notes)
+        {
+            glideFrameHz(fHot.frequencies_in_hz, fHot.target_frequencies_in_hz, fHot.glide_delta, remaining);
+            return;
+        }
+        
+        for (int32_t n = 0; n < fHot.glide_note_count; n++)
+        {
+            const uint8_t i = fHot.glide_notes[n];
+            fHot.frequencies_in_hz[i] = fHot.target_frequencies_in_hz[i] - fHot.glide_delta[i] * remaining;
+        }
+    }
+    
+   /**
+      The pitch glide works out exact frequencies with exp2 only at the start of each segment, together with the
+      constant ratio per frame that takes each note to where the curve will be at the end of it. In between, a note
+      costs one multiply per frame, the same as the Hz glide. Segments are kPitchSegmentFrames long, but a glide of
+      known length gets at least kMinPitchSegments of them, so short glides keep their curve.
+    */
+    void advancePitchGlide(double previous, double remaining)
+    {
+        const Transition& glide(fHot.glide);
+        const uint32_t position = fHot.glide_position;
+        
+        if (position < fHot.pitch_segment_end)
+        {
+            if (fHot.glide_all_notes)
+            {
+                glidePitchFrame(fHot.frequencies_in_hz, fHot.glide_ratio);
+                return;
+            }
+            
+            for (int32_t n = 0; n < fHot.glide_note_count; n++)
+                fHot.frequencies_in_hz[fHot.glide_notes[n]] *= fHot.glide_ratio[fHot.glide_notes[n]];
+            return;
+        }
+        
+        uint32_t frames = kPitchSegmentFrames;
+        if (glide.samples != 0)
+            frames = std::min<uint32_t>({ frames, std::max(1u, glide.samples / kMinPitchSegments), glide.samples - position });
+        fHot.pitch_segment_end = position + frames;
+        
+        double remainingAtEnd;
+        if (glide.curve == kCurveExponential)
+            remainingAtEnd = remaining * std::pow(remaining / previous, static_cast<double>(frames));
+        else
+            remainingAtEnd = curveRemaining(glide, position + frames);
+        
+        const double step = (remaining - remainingAtEnd) / frames;
+        
+        if (fHot.glide_all_notes)
+        {
+            glidePitchSegment(fHot.frequencies_in_hz, fHot.glide_ratio, fHot.log2_target, fHot.glide_delta, remaining,
+                              step);
+            return;
+        }
+        
+        for (int32_t n = 0; n < fHot.glide_note_count; n++)
+        {
+            const uint8_t i = fHot.glide_notes[n];
+            fHot.frequencies_in_hz[i] = fastExp2(fHot.log2_target[i] - fHot.glide_delta[i] * remaining);
+            fHot.glide_ratio[i] = fastExp2(fHot.glide_delta[i] * step);
+        }
+    }
+    
+    // The remaining fraction of a linear or smooth glide @a position frames in
+    static double curveRemaining(const Transition& glide, uint32_t position) noexcept
+    {
+        double progress = std::min(1.0, position * glide.coefficient);
+        if (glide.curve == kCurveSmooth)
+            progress = progress * progress * (3.0 - 2.0 * progress);
+        return 1.0 - progress;
+    }
+    
+   /**
+      Everything run() touches on every block, packed together at the front of the object.
+      The per-block scalars come first, a few cache lines of them, with the frequency tables straight after. Tables
+      and state only some modes or events use follow those. Nothing is aligned to a cache line, as the plugin is
+      allocated with plain new, which only promises that from C++17.
+    */
+    struct HotState
+    {
+        int32_t current_scale;
+        int32_t step_index;
+        int32_t pattern;
+        int32_t last_bar;
+        double current_multiplier;
+        
+        // The glide under way, copied from the step that started it
+        Transition glide;
+        uint32_t glide_position;
+        // Frame of the pitch glide's next exact frequencies
+        uint32_t pitch_segment_end;
+        uint32_t current_generation;
+        double remaining;
+        double largest_delta;
+        bool gliding;
+        bool pitch_glide;
+        bool glide_in_pitch;
+        
+        // Notes held at the MIDI input on any channel, one bit each, and on each channel
+        uint64_t held_notes[2];
+        uint64_t channel_notes[kMidiChannelCount][2];
+        bool held_notes_only;
+        // Whether the glide under way moves every note, or only the glide_note_count notes listed in glide_notes
+        bool glide_all_notes;
+        int32_t glide_note_count;
+        
+        // Retune On Note On: whether the tuning has changed since it was last published, and this block's events,
+        // with the next one to look at and the frame rendering has reached
+        bool retune_on_note_on;
+        bool publish_pending;
+        // Coalescing of glide frames: the remaining fraction last sent, cents per unit of it, and the limits
+        double published_remaining;
+        double publish_scale;
+        double publish_threshold;
+        uint32_t frames_since_publish;
+        uint32_t publish_interval;
+        double sample_rate;
+        
+        // Whether published_hz holds what clients were last sent
+        bool published_valid;
+        
+        // Whether any synth was listening at the last check, and frames until the next one
+        bool has_clients;
+        uint32_t client_check_countdown;
+        uint32_t client_check_interval;
+        
+        // Whether the publisher thread sends the tuning, and if this block has a table for it
+        bool publish_from_thread;
+        bool handoff_pending;
+        uint32_t render_frame;
+        const MidiEvent* block_events;
+        uint32_t block_event_count;
+        uint32_t next_block_event;
+        
+        // The plan of the pattern playing, only read when the step changes
+        const TransitionPlan* plan;
+        // Scale Glide, and Glide Sync in whole notes or 0, for the steps that follow them
+        float scale_glide;
+        double glide_sync_notes;
+        double samples_per_note;
+        
+        int32_t transport;
+        // Host frame expected at the start of the next block
+        uint64_t expected_frame;
+        // The sample clock: samples since the position last taken from the host, and the next boundary on it
+        double origin_beats;
+        double samples_per_beat;
+        int64_t clock;
+        int64_t next_boundary_sample;
+        uint32_t blocks_since_check;
+        BoundaryInputs boundary_inputs;
+        bool boundary_stale;
+        // Set by warmStart(), so the first block after activation goes straight to the step the host is really on
+        bool warm_start;
+        
+        double frequencies_in_hz[kMidiNoteCount];
+        double target_frequencies_in_hz[kMidiNoteCount];
+        // Difference at the start of the glide, in Hz or in octaves
+        double glide_delta[kMidiNoteCount];
+        
+        // Only used by the pitch glide
+        double log2_target[kMidiNoteCount];
+        double glide_ratio[kMidiNoteCount];
+        
+        // The notes the glide under way moves, when it isn't all of them
+        uint8_t glide_notes[kMidiNoteCount];
+        
+        // What clients were last sent, so only the notes that differ need sending
+        double published_hz[kMidiNoteCount];
+        
+        // Only used by the MIDI and internal clocks
+        MidiClock midi_clock;
+        // Samples since activate(), and the same in beats at the Tempo parameter
+        uint64_t internal_samples;
+        double internal_beats;
+    };
+    
+   /**
+      Everything else: the slots with their files and baked tables, the step patterns and their plan, and the loader.
+      Allocated on its own, so none of it sits next to the hot state.
+    */
+    struct ColdState
+    {
+        explicit ColdState(float rate)
+            : sampleRate(rate),
+              published(0),
+              loader(slots, deltas)
+        {
+            for (int32_t i = 0; i < kScaleSlotCount; i++)
+                slots[i].notifyOnPublish(&published, 1u << i);
+            
+            for (int32_t i = 0; i < kPatternCount; i++)
+                resetStepPattern(bank.patterns[i]);
+            // Empty until sampleRateChanged() compiles the bank
+            bankPlans.fill(TransitionPlanBank());
+        }
+        
+        float sampleRate;
+        ScaleSlot slots[kScaleSlotCount];
+        
+        // One bit per slot with a table that run() hasn't picked up yet
+        std::atomic<uint32_t> published;
+        
+        // The bank as last set by setState, and the same compiled for run(). Both setState and sampleRateChanged
+        // compile it, so they take turns.
+        StepBank bank;
+        TripleBuffer<TransitionPlanBank> bankPlans;
+        std::mutex bankMutex;
+        
+        // The step parameters as a pattern, refreshed from the parameter snapshot every block, and their plan
+        StepPattern liveSteps;
+        TransitionPlan livePlan;
+        
+        TransitionDeltas deltas;
+        
+        ScaleLoader loader;
+        TuningPublisher publisher;
+    };
     
-    double frequencies_in_hz[128];
-    double target_frequencies_in_hz[128];
-    uint32_t current_scale;
+    HotState fHot;
+    ParameterStore fParameters;
+    const std::unique_ptr<ColdState> fCold;
 
    /**
       Set our plugin class as non-copyable and add a leak detector just in case.
@@ -0,0 +1,100 @@
+#ifndef SCALESEQUENCE_ARENA_HPP
+#define SCALESEQUENCE_ARENA_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+#include "DistrhoUtils.hpp"
+
+START_NAMESPACE_DISTRHO
+
+/**
+   Monotonic (bump) allocator for everything that only lives as long as one load.
+   Allocations come from a caller supplied buffer first, usually on the stack, then from larger heap blocks.
+   Nothing is freed individually: the whole arena goes away in one go when it is released or destroyed.
+ */
+class MonotonicArena
+{
+public:
+    MonotonicArena(void* initial, size_t size, size_t blockSize = 16384) noexcept
+        : fHead(nullptr),
+          fPos(static_cast<char*>(initial)),
+          fEnd(static_cast<char*>(initial) + size),
+          fBlockSize(blockSize) {}
+
+    ~MonotonicArena()
+    {
+        release();
+    }
+
+    // Returns nullptr if the memory cannot be found, never throws
+    void* allocate(size_t size, size_t alignment = alignof(std::max_align_t)) noexcept
+    {
+        char* p = align(fPos, alignment);
+
+        if (p == nullptr || p > fEnd || size > static_cast<size_t>(fEnd - p))
+        {
+            const size_t needed = sizeof(Block) + alignment + size;
+            const size_t blockSize = needed > fBlockSize ? needed : fBlockSize;
+
+            Block* const block = static_cast<Block*>(std::malloc(blockSize));
+            if (block == nullptr)
+                return nullptr;
+
+            block->next = fHead;
+            fHead = block;
+            fEnd = reinterpret_cast<char*>(block) + blockSize;
+            p = align(reinterpret_cast<char*>(block + 1), alignment);
+        }
+
+        fPos = p + size;
+        return p;
+    }
+
+    // Storage for @a count trivially constructible objects
+    template <class T>
+    T* allocateArray(size_t count) noexcept
+    {
+        if (count > SIZE_MAX / sizeof(T))
+            return nullptr;
+        return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+    }
+
+    // Free every heap block at once. The initial buffer is left alone.
+    void release() noexcept
+    {
+        while (fHead != nullptr)
+        {
+            Block* const next = fHead->next;
+            std::free(fHead);
+            fHead = next;
+        }
+        fPos = fEnd = nullptr;
+    }
+
+private:
+    struct Block
+    {
+        Block* next;
+    };
+
+    static char* align(char* p, size_t alignment) noexcept
+    {
+        if (p == nullptr)
+            return nullptr;
+        const uintptr_t mask = alignment - 1;
+        return reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(p) + mask) & ~mask);
+    }
+
+    Block* fHead;
+    char* fPos;
+    char* fEnd;
+    const size_t fBlockSize;
+
+    DISTRHO_DECLARE_NON_COPYABLE(MonotonicArena)
+};
+
+END_NAMESPACE_DISTRHO
+
+#endif
@@ -0,0 +1,491 @@
+/*
+   Benchmarks for ScaleSequence. They are not part of the plugin, and are built with the SCALESEQUENCE_BUILD_TOOLS
+   option, optimised whatever the build type:
+
+     cmake -S . -B build -DSCALESEQUENCE_BUILD_TOOLS=ON
+     cmake --build build --target scalesequence_benchmark
+     ./build/scalesequence_benchmark parser path/to/scales
+
+   parser <files or directories>
+     Reads every .scl and .kbm file given, walking directories, and times parseScl/parseKbm against
+     Tunings::readSCLStream/readKBMStream on the same bytes in memory, and then the whole load from the file as the
+     loader does it against Tunings::readSCLFile/readKBMFile. Meant to be run over the Scala archive
+     (https://www.huygens-fokker.org/docs/scales.zip, unzipped).
+
+   glide
+     Times a frame of the Hz glide against a frame of the pitch glide, over every note, with the kernels run() uses.
+     The pitch glide is averaged over whole segments of kPitchSegmentFrames.
+
+   publish
+     Times sending a number of changed notes one at a time against sending the whole table, as sendTuning() does,
+     and reports where the whole table starts to pay off (kSingleNoteCrossover). The MTS-ESP calls go to a stand-in
+     for libMTS, defined below, rather than the real library.
+
+   Each figure is the best of several runs, each run repeating the work for at least kMinRunMs.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "ScaleSequenceParser.hpp"
+#include "ScaleSequencePublisher.hpp"
+#include "ScaleSequenceTuning.hpp"
+
+USE_NAMESPACE_DISTRHO
+
+namespace {
+
+enum {
+    kRuns = 5,
+    kMinRunMs = 200
+};
+
+// Results are added here, so the work being timed can't be optimised away
+volatile double gSink;
+
+// Best time of kRuns runs of @a work, in nanoseconds per call
+template <class Work>
+double timePerCall(Work work)
+{
+    typedef std::chrono::steady_clock clock;
+
+    double best = 0.0;
+
+    for (int32_t run = 0; run < kRuns; run++)
+    {
+        uint64_t calls = 0;
+        const clock::time_point start = clock::now();
+        clock::time_point now = start;
+
+        do
+        {
+            work();
+            ++calls;
+            now = clock::now();
+        } while (now - start < std::chrono::milliseconds(kMinRunMs));
+
+        const double ns = std::chrono::duration<double, std::nano>(now - start).count() / calls;
+        best = run == 0 ? ns : std::min(best, ns);
+    }
+
+    return best;
+}
+
+/* Parser */
+
+struct SourceFile
+{
+    std::string path;
+    std::string contents;
+    bool isScl;
+};
+
+bool endsWith(const std::string& text, const char* suffix)
+{
+    const size_t length = std::strlen(suffix);
+    return text.size() >= length && text.compare(text.size() - length, length, suffix) == 0;
+}
+
+// Collect the .scl and .kbm files under @a path. Directories are walked with POSIX dirent.
+void collectFiles(const std::string& path, std::vector<SourceFile>& files)
+{
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0)
+    {
+        std::fprintf(stderr, "Cannot read %s\n", path.c_str());
+        return;
+    }
+
+    if (S_ISDIR(st.st_mode))
+    {
+        DIR* const dir = ::opendir(path.c_str());
+        if (dir == nullptr)
+            return;
+
+        std::vector<std::string> names;
+        while (const struct dirent* const entry = ::readdir(dir))
+        {
+            if (std::strcmp(entry->d_name, ".") != 0 && std::strcmp(entry->d_name, "..") != 0)
+                names.push_back(entry->d_name);
+        }
+        ::closedir(dir);
+
+        std::sort(names.begin(), names.end());
+        for (const std::string& name : names)
+            collectFiles(path + "/" + name, files);
+        return;
+    }
+
+    const bool isScl = endsWith(path, ".scl") || endsWith(path, ".SCL");
+    if (! isScl && ! endsWith(path, ".kbm") && ! endsWith(path, ".KBM"))
+        return;
+
+    std::FILE* const file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr)
+        return;
+
+    SourceFile source;
+    source.path = path;
+    source.isScl = isScl;
+
+    char buffer[4096];
+    size_t length;
+    while ((length = std::fread(buffer, 1, sizeof(buffer), file)) != 0)
+        source.contents.append(buffer, length);
+    std::fclose(file);
+
+    files.push_back(source);
+}
+
+// parseScl/parseKbm on a file already in memory, as ScaleSlot::load() does after reading it
+bool parseOurs(const SourceFile& source)
+{
+    alignas(std::max_align_t) char initial[8192];
+    MonotonicArena arena(initial, sizeof(initial));
+
+    if (source.isScl)
+    {
+        ScaleData scale;
+        if (! parseScl(source.contents.data(), source.contents.size(), arena, scale).ok())
+            return false;
+        gSink = gSink + scale.tones[scale.count - 1].cents;
+        return true;
+    }
+
+    MappingData mapping;
+    if (! parseKbm(source.contents.data(), source.contents.size(), arena, mapping).ok())
+        return false;
+    gSink = gSink + mapping.tuningFrequency;
+    return true;
+}
+
+bool parseTheirs(const SourceFile& source)
+{
+    try
+    {
+        std::istringstream stream(source.contents);
+
+        if (source.isScl)
+            gSink = gSink + Tunings::readSCLStream(stream).tones.back().cents;
+        else
+            gSink = gSink + Tunings::readKBMStream(stream).tuningFrequency;
+        return true;
+    }
+    catch (const Tunings::TuningError&)
+    {
+        return false;
+    }
+}
+
+// The whole load from the file, as the loader does it
+bool loadOurs(const SourceFile& source)
+{
+    alignas(std::max_align_t) char initial[8192];
+    MonotonicArena arena(initial, sizeof(initial));
+
+    TextView contents;
+    if (! readFileContents(source.path.c_str(), arena, contents))
+        return false;
+
+    const size_t size = static_cast<size_t>(contents.end - contents.begin);
+
+    if (source.isScl)
+    {
+        ScaleData scale;
+        if (! parseScl(contents.begin, size, arena, scale).ok())
+            return false;
+        gSink = gSink + scale.tones[scale.count - 1].cents;
+        return true;
+    }
+
+    MappingData mapping;
+    if (! parseKbm(contents.begin, size, arena, mapping).ok())
+        return false;
+    gSink = gSink + mapping.tuningFrequency;
+    return true;
+}
+
+bool loadTheirs(const SourceFile& source)
+{
+    try
+    {
+        if (source.isScl)
+            gSink = gSink + Tunings::readSCLFile(source.path).tones.back().cents;
+        else
+            gSink = gSink + Tunings::readKBMFile(source.path).tuningFrequency;
+        return true;
+    }
+    catch (const Tunings::TuningError&)
+    {
+        return false;
+    }
+}
+
+void reportParser(const char* name, const std::vector<SourceFile>& files, size_t bytes, bool (*parse)(const SourceFile&))
+{
+    size_t rejected = 0;
+    for (const SourceFile& source : files)
+        rejected += parse(source) ? 0 : 1;
+
+    const double ns = timePerCall([&files, parse] {
+        for (const SourceFile& source : files)
+            parse(source);
+    });
+
+    std::printf("  %-36s %8.1f us per file %9.1f MB/s %7zu rejected\n", name, ns / 1000.0 / files.size(),
+                bytes * 1000.0 / ns, rejected);
+}
+
+int benchmarkParser(int count, char** paths)
+{
+    std::vector<SourceFile> files;
+    for (int i = 0; i < count; i++)
+        collectFiles(paths[i], files);
+
+    for (const bool scl : { true, false })
+    {
+        std::vector<SourceFile> subset;
+        size_t bytes = 0;
+        for (const SourceFile& source : files)
+        {
+            if (source.isScl == scl)
+            {
+                subset.push_back(source);
+                bytes += source.contents.size();
+            }
+        }
+
+        if (subset.empty())
+            continue;
+
+        std::printf("%zu %s files, %zu bytes\n", subset.size(), scl ? "SCL" : "KBM", bytes);
+        reportParser(scl ? "parseScl, in memory" : "parseKbm, in memory", subset, bytes, parseOurs);
+        reportParser(scl ? "readSCLStream, in memory" : "readKBMStream, in memory", subset, bytes, parseTheirs);
+        reportParser("readFileContents + parse, from file", subset, bytes, loadOurs);
+        reportParser(scl ? "readSCLFile, from file" : "readKBMFile, from file", subset, bytes, loadTheirs);
+    }
+
+    if (files.empty())
+    {
+        std::fprintf(stderr, "No .scl or .kbm files found\n");
+        return 1;
+    }
+    return 0;
+}
+
+/* Glide */
+
+enum {
+    // Frames of one glide, timed as a whole
+    kGlideFrames = 4096
+};
+
+// Stops the compiler from merging frames, as publishing the tuning between them does in run()
+inline void clobberMemory()
+{
+#ifdef _MSC_VER
+    _ReadWriteBarrier();
+#else
+    asm volatile("" : : : "memory");
+#endif
+}
+
+// The tables startGlide() leaves for a glide between two tunings, in Hz and in octaves
+struct GlideTables
+{
+    double frequencies[kMidiNoteCount];
+    double targets[kMidiNoteCount];
+    double deltas[kMidiNoteCount];
+    double log2Targets[kMidiNoteCount];
+    double log2Deltas[kMidiNoteCount];
+    double ratios[kMidiNoteCount];
+};
+
+// Two random tunings a few cents to a semitone apart, the size of difference a scale change makes
+void fillGlideTables(GlideTables& tables)
+{
+    std::mt19937 random(1);
+    std::uniform_real_distribution<double> cents(-100.0, 100.0);
+
+    for (int32_t i = 0; i < kMidiNoteCount; i++)
+    {
+        const double from = 440.0 * std::exp2((i - 69 + cents(random) / 100.0) / 12.0);
+        tables.targets[i] = 440.0 * std::exp2((i - 69 + cents(random) / 100.0) / 12.0);
+        tables.deltas[i] = tables.targets[i] - from;
+        tables.log2Targets[i] = std::log2(tables.targets[i]);
+        tables.log2Deltas[i] = tables.log2Targets[i] - std::log2(from);
+        tables.frequencies[i] = from;
+    }
+}
+
+// The one-pole curve, as advanceGlide() follows it
+void glideHz(GlideTables& tables, double coefficient)
+{
+    double remaining = 1.0;
+
+    for (int32_t frame = 0; frame < kGlideFrames; frame++)
+    {
+        remaining *= 1.0 - coefficient;
+        glideFrameHz(tables.frequencies, tables.targets, tables.deltas, remaining);
+        clobberMemory();
+    }
+
+    gSink = gSink + tables.frequencies[69];
+}
+
+// The same curve as advancePitchGlide() follows it, exact at the start of every segment
+void glidePitch(GlideTables& tables, double coefficient)
+{
+    double remaining = 1.0;
+
+    for (int32_t frame = 0; frame < kGlideFrames; frame++)
+    {
+        const double previous = remaining;
+        remaining *= 1.0 - coefficient;
+
+        if (frame % kPitchSegmentFrames != 0)
+        {
+            glidePitchFrame(tables.frequencies, tables.ratios);
+            clobberMemory();
+            continue;
+        }
+
+        const double remainingAtEnd = remaining * std::pow(remaining / previous, static_cast<double>(kPitchSegmentFrames));
+        const double step = (remaining - remainingAtEnd) / kPitchSegmentFrames;
+        glidePitchSegment(tables.frequencies, tables.ratios, tables.log2Targets, tables.log2Deltas, remaining, step);
+        clobberMemory();
+    }
+
+    gSink = gSink + tables.frequencies[69];
+}
+
+int benchmarkGlide()
+{
+    GlideTables tables;
+    fillGlideTables(tables);
+
+    // Scale Glide at 1, a time constant of a thousand samples
+    const double coefficient = 1.0 / 1000.0;
+
+    const double hz = timePerCall([&tables, coefficient] { glideHz(tables, coefficient); }) / kGlideFrames;
+    const double pitch = timePerCall([&tables, coefficient] { glidePitch(tables, coefficient); }) / kGlideFrames;
+
+    std::printf("%d notes, exponential curve, exact pitch every %d frames\n", kMidiNoteCount, kPitchSegmentFrames);
+    std::printf("  %-36s %8.1f ns per frame\n", "Hz glide", hz);
+    std::printf("  %-36s %8.1f ns per frame %7.2fx\n", "pitch glide", pitch, pitch / hz);
+    return 0;
+}
+
+/* Publishing */
+
+enum {
+    // Sends per timed call, so reading the clock doesn't count
+    kSendsPerCall = 1000
+};
+
+/**
+   Stands in for libMTS, the library the MTS-ESP master functions load at run time and call through function pointers.
+   Like it, the stand-in is only reached through pointers, and it stores the frequencies in a table the clients read.
+   Whatever more the real library does per call is not counted.
+ */
+double gSharedTable[kMidiNoteCount];
+
+void mockSetNoteTunings(const double* frequencies)
+{
+    for (int32_t i = 0; i < kMidiNoteCount; i++)
+        gSharedTable[i] = frequencies[i];
+}
+
+void mockSetNoteTuning(double frequency, char note)
+{
+    gSharedTable[note & 0x7F] = frequency;
+}
+
+void (*volatile gSetNoteTunings)(const double*) = mockSetNoteTunings;
+void (*volatile gSetNoteTuning)(double, char) = mockSetNoteTuning;
+
+int benchmarkPublish()
+{
+    double frequencies[kMidiNoteCount], published[kMidiNoteCount];
+    for (int32_t i = 0; i < kMidiNoteCount; i++)
+        frequencies[i] = published[i] = 440.0 * std::exp2((i - 69) / 12.0);
+
+    const double table = timePerCall([&frequencies, &published] {
+        for (int32_t k = 0; k < kSendsPerCall; k++)
+            sendTable(frequencies, published);
+    }) / kSendsPerCall;
+
+    std::printf("Sending changed notes through a stand-in for libMTS, kSingleNoteCrossover is %d\n",
+                static_cast<int>(kSingleNoteCrossover));
+    std::printf("  %-36s %8.1f ns per send\n", "whole table", table);
+
+    int32_t crossover = 0;
+
+    for (const int32_t count : { 1, 2, 4, 8, 12, 16, 20, 24, 28, 32, 40, 48, 64, 96, 128 })
+    {
+        // Spread over the keyboard, as the held notes of a glide or the notes a new scale changes would be
+        uint8_t notes[kMidiNoteCount];
+        for (int32_t n = 0; n < count; n++)
+            notes[n] = static_cast<uint8_t>(n * kMidiNoteCount / count);
+
+        const double ns = timePerCall([&frequencies, &published, &notes, count] {
+            for (int32_t k = 0; k < kSendsPerCall; k++)
+                sendNotes(frequencies, published, notes, count);
+        }) / kSendsPerCall;
+
+        char name[64];
+        std::snprintf(name, sizeof(name), "%d notes one at a time", count);
+        std::printf("  %-36s %8.1f ns per send %7.2fx\n", name, ns, ns / table);
+
+        if (crossover == 0 && ns >= table)
+            crossover = count;
+    }
+
+    if (crossover != 0)
+        std::printf("The whole table is as quick from %d changed notes\n", crossover);
+    return 0;
+}
+
+void usage()
+{
+    std::fprintf(stderr, "usage: scalesequence_benchmark parser <files or directories>\n"
+                         "       scalesequence_benchmark glide\n"
+                         "       scalesequence_benchmark publish\n");
+}
+
+}
+
+// The MTS-ESP master functions sendTuning() calls, going to the stand-in
+void MTS_SetNoteTunings(const double* freqs)
+{
+    gSetNoteTunings(freqs);
+}
+
+void MTS_SetNoteTuning(double freq, char midinote)
+{
+    gSetNoteTuning(freq, midinote);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc >= 3 && std::strcmp(argv[1], "parser") == 0)
+        return benchmarkParser(argc - 2, argv + 2);
+    if (argc == 2 && std::strcmp(argv[1], "glide") == 0)
+        return benchmarkGlide();
+    if (argc == 2 && std::strcmp(argv[1], "publish") == 0)
+        return benchmarkPublish();
+
+    usage();
+    return 1;
+}
@@ -0,0 +1,205 @@
+#ifndef SCALESEQUENCE_CLOCK_HPP
+#define SCALESEQUENCE_CLOCK_HPP
+
+#include <cmath>
+#include <cstdint>
+
+#include "DistrhoPlugin.hpp"
+
+START_NAMESPACE_DISTRHO
+
+// Choices of the Clock Source parameter, where beats and bars steps take their position from
+enum ClockSource {
+    kClockHost = 0,
+    kClockMidi = 1,
+    // Counts samples at the Tempo parameter from activate()
+    kClockInternal = 2,
+    // At the Tempo parameter from the host's frame, moving only while the host is playing
+    kClockHostFrame = 3
+};
+
+enum {
+    // Clocks of our own have no meter, so they count in 4/4
+    kClockBeatsPerBar = 4,
+    kClockTicksPerBeat = 1920
+};
+
+// Fill in @a timePos for a clock of our own at @a beats from the start
+inline void setClockTimePosition(TimePosition& timePos, double beats, double beatsPerMinute, bool playing) noexcept
+{
+    const double bar = std::floor(beats / kClockBeatsPerBar);
+    const double inBar = beats - bar * kClockBeatsPerBar;
+
+    timePos.playing = playing;
+    timePos.bbt.valid = beatsPerMinute > 0.0;
+    timePos.bbt.bar = static_cast<int32_t>(bar) + 1;
+    timePos.bbt.beat = static_cast<int32_t>(inBar) + 1;
+    timePos.bbt.tick = (inBar - std::floor(inBar)) * kClockTicksPerBeat;
+    timePos.bbt.barStartTick = bar * kClockBeatsPerBar * kClockTicksPerBeat;
+    timePos.bbt.beatsPerBar = kClockBeatsPerBar;
+    timePos.bbt.beatType = 4.0f;
+    timePos.bbt.ticksPerBeat = kClockTicksPerBeat;
+    timePos.bbt.beatsPerMinute = beatsPerMinute;
+}
+
+/**
+   Follows a MIDI clock (24 ticks per beat) with its start, stop, continue and song position messages, for use where
+   the host has no transport of its own.
+   Tick times are smoothed with a second order phase-locked loop, so a jittery clock still gives a steady tempo and a
+   position that can be read at any sample. Everything is plain state updated in place, so it never allocates.
+ */
+class MidiClock
+{
+public:
+    MidiClock() noexcept
+    {
+        reset();
+    }
+
+    void reset() noexcept
+    {
+        fNow = 0;
+        fRunning = false;
+        fTicks = -1.0;
+        fTickedSinceStart = false;
+        fTickSample = 0.0;
+        fLastTickSample = -1.0;
+        fPeriod = 0.0;
+    }
+
+    // Start, stop, continue and song position change the position or the transport, so a block is split at them
+    static bool isTransportMessage(const uint8_t* data, uint32_t size) noexcept
+    {
+        return (size == 1 && (data[0] == 0xFA || data[0] == 0xFB || data[0] == 0xFC))
+               || (size == 3 && data[0] == 0xF2);
+    }
+
+    // Take in one message at @a frame of the current block. Anything other than clock messages is ignored.
+    void process(const uint8_t* data, uint32_t size, uint32_t frame) noexcept
+    {
+        if (size == 1)
+        {
+            switch (data[0])
+            {
+            case 0xF8:
+                tick(static_cast<double>(fNow + frame));
+                break;
+            case 0xFA: // Start, from the top on the next tick
+                fTicks = -1.0;
+                fTickedSinceStart = false;
+                fRunning = true;
+                break;
+            case 0xFB: // Continue, from where it stopped on the next tick
+                fTickedSinceStart = false;
+                fRunning = true;
+                break;
+            case 0xFC:
+                fRunning = false;
+                break;
+            }
+        }
+        else if (size == 3 && data[0] == 0xF2 && ! fRunning)
+        {
+            // Song position in sixteenth notes, 6 ticks each, reached on the next tick
+            const int32_t sixteenths = (data[1] & 0x7F) | ((data[2] & 0x7F) << 7);
+            fTicks = sixteenths * 6.0 - 1.0;
+        }
+    }
+
+    // Move on to the next block
+    void advance(uint32_t frames) noexcept
+    {
+        fNow += frames;
+    }
+
+    bool isLocked() const noexcept
+    {
+        return fPeriod > 0.0;
+    }
+
+    /**
+       The clock's transport at @a frame of the current block, in 4/4.
+       The host frame is left at 0, so a song position or a restart shows up as a jump in bars and beats.
+     */
+    void getTimePosition(TimePosition& timePos, uint32_t frame, double sampleRate) const noexcept
+    {
+        const double beatsPerMinute = isLocked() ? 60.0 * sampleRate / (fPeriod * kClocksPerBeat) : 0.0;
+
+        setClockTimePosition(timePos, beatsAt(static_cast<double>(fNow + frame)), beatsPerMinute, fRunning);
+        timePos.frame = 0;
+    }
+
+private:
+    enum {
+        kClocksPerBeat = 24
+    };
+
+    /**
+       The loop keeps an estimate of the time of the last tick and of the period. Each tick corrects both by a fraction
+       of how far it landed from where it was expected, which filters out jitter while following tempo changes.
+       A tick that is far out (the clock was stopped, or jumped in tempo) locks on again from scratch.
+     */
+    void tick(double sample) noexcept
+    {
+        static const double kPhaseGain = 0.2;
+        static const double kFrequencyGain = 0.02;
+
+        const double previous = fLastTickSample;
+        fLastTickSample = sample;
+
+        if (fRunning)
+        {
+            fTicks += 1.0;
+            fTickedSinceStart = true;
+        }
+
+        if (previous < 0.0)
+        {
+            fTickSample = sample;
+            return;
+        }
+
+        const double interval = sample - previous;
+        if (interval <= 0.0)
+            return;
+
+        if (fPeriod <= 0.0 || interval > 2.0 * fPeriod || interval < 0.5 * fPeriod)
+        {
+            fPeriod = interval;
+            fTickSample = sample;
+            return;
+        }
+
+        const double error = sample - (fTickSample + fPeriod);
+        fTickSample += fPeriod + kPhaseGain * error;
+        fPeriod += kFrequencyGain * error;
+    }
+
+    // Song position in beats at @a sample, which never runs past the next tick
+    double beatsAt(double sample) const noexcept
+    {
+        double ticks = fTicks + 1.0;
+
+        if (fRunning && fTickedSinceStart && isLocked())
+        {
+            const double fraction = (sample - fTickSample) / fPeriod;
+            ticks = fTicks + std::fmin(1.0, std::fmax(0.0, fraction));
+        }
+
+        return std::fmax(0.0, ticks) / kClocksPerBeat;
+    }
+
+    uint64_t fNow;
+    bool fRunning;
+    // Song position of the last tick, in ticks
+    double fTicks;
+    bool fTickedSinceStart;
+    // Smoothed time of the last tick and tick period, in samples since the clock was reset
+    double fTickSample;
+    double fLastTickSample;
+    double fPeriod;
+};
+
+END_NAMESPACE_DISTRHO
+
+#endif
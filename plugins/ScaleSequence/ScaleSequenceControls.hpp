@@ -32,7 +32,19 @@ enum Parameters {
     kParameterOffset     = 19,
     kParameterLoopPoint  = 20,
     kParameterCurrentStep = 21,
-    kParameterCount      = 22
+    kParameterPattern    = 22,
+    kParameterPitchGlide = 23,
+    kParameterGlideSync  = 24,
+    kParameterGlideAhead = 25,
+    kParameterSnapOnJump = 26,
+    kParameterClockSource = 27,
+    kParameterTempo      = 28,
+    kParameterHeldNotesOnly = 29,
+    kParameterRetuneOnNoteOn = 30,
+    kParameterPublishThreshold = 31,
+    kParameterPublishFromThread = 32,
+    kParameterPublishLatency = 33,
+    kParameterCount      = 34
 };
 
 enum States {
@@ -44,7 +56,8 @@ enum States {
     kStateFileKBM2 = 5,
     kStateFileKBM3 = 6,
     kStateFileKBM4 = 7,
-    kStateCount    = 8
+    kStateStepPatterns = 8,
+    kStateCount    = 9
 };
 
 static const std::array<std::pair<float, float>, kParameterCount> controlLimits =
@@ -70,7 +83,19 @@ static const std::array<std::pair<float, float>, kParameterCount> controlLimits
     {1.0f, 4.0f},    //kParameterStep16,
     {-1.0f, 1.0f},   //kParameterOffset
     {2.0f, 16.0f},    //kParameterLoopPoint
-    {0.0f, 1.0f}    //kParameterCurrentStep
+    {0.0f, 4.0f},    //kParameterCurrentStep (step number * 0.0625, up to 64 steps)
+    {0.0f, 8.0f},    //kParameterPattern
+    {0.0f, 1.0f},    //kParameterPitchGlide
+    {0.0f, 6.0f},    //kParameterGlideSync
+    {0.0f, 1.0f},    //kParameterGlideAhead
+    {0.0f, 1.0f},    //kParameterSnapOnJump
+    {0.0f, 3.0f},    //kParameterClockSource
+    {20.0f, 300.0f}, //kParameterTempo
+    {0.0f, 1.0f},    //kParameterHeldNotesOnly
+    {0.0f, 1.0f},    //kParameterRetuneOnNoteOn
+    {0.0f, 5.0f},    //kParameterPublishThreshold
+    {0.0f, 1.0f},    //kParameterPublishFromThread
+    {0.0f, 100.0f}   //kParameterPublishLatency (ms)
 }};
 
 static const float ParameterDefaults[kParameterCount] = {
@@ -95,7 +120,19 @@ static const float ParameterDefaults[kParameterCount] = {
     1.0f, //kParameterStep16,
     0.0f, //kParameterOffset
     16.0f, //kParameterLoopPoint
-    1.0f //kParameterCurrentStep (default not used)
+    1.0f, //kParameterCurrentStep (default not used)
+    0.0f, //kParameterPattern
+    0.0f, //kParameterPitchGlide
+    0.0f, //kParameterGlideSync
+    0.0f, //kParameterGlideAhead
+    0.0f, //kParameterSnapOnJump
+    0.0f, //kParameterClockSource
+    120.0f, //kParameterTempo
+    0.0f, //kParameterHeldNotesOnly
+    0.0f, //kParameterRetuneOnNoteOn
+    0.1f, //kParameterPublishThreshold
+    0.0f, //kParameterPublishFromThread
+    0.0f //kParameterPublishLatency
 	
 };
 
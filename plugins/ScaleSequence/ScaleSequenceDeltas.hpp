@@ -0,0 +1,128 @@
+#ifndef SCALESEQUENCE_DELTAS_HPP
+#define SCALESEQUENCE_DELTAS_HPP
+
+#include <cmath>
+#include <cstring>
+#include <mutex>
+
+#include "ScaleSequenceSlots.hpp"
+
+START_NAMESPACE_DISTRHO
+
+enum {
+    // Ordered pairs of two different slots. A slot is never glided from to itself.
+    kSlotPairCount = kScaleSlotCount * (kScaleSlotCount - 1)
+};
+
+/**
+   The difference between the tables of every ordered pair of different slots, for every note, in Hz and in octaves
+   (log2), indexed by pairIndex(). Each set records the generation of the tables it was built from, so a stale pair
+   is never used.
+ */
+struct DeltaSet
+{
+    uint32_t generations[kScaleSlotCount];
+    double hz[kSlotPairCount][kMidiNoteCount];
+    double log2[kSlotPairCount][kMidiNoteCount];
+    // Largest difference of each pair, which tells when an open-ended glide has arrived
+    double largest[kSlotPairCount];
+    double largestLog2[kSlotPairCount];
+
+    // Each slot has a row of the other three, skipping the diagonal
+    static int32_t pairIndex(int32_t from, int32_t to) noexcept
+    {
+        return from * (kScaleSlotCount - 1) + (to < from ? to : to - 1);
+    }
+
+    bool matches(int32_t from, uint32_t fromGeneration, int32_t to, uint32_t toGeneration) const noexcept
+    {
+        return generations[from] == fromGeneration && generations[to] == toGeneration;
+    }
+};
+
+/**
+   Builds the pairwise differences on the loader threads whenever one of an instance's slots has been loaded,
+   and hands them to run() through a triple buffer. Four slots make twelve pairs, so every pair is kept: about 24 KB
+   per set, three sets for the buffer.
+ */
+class TransitionDeltas
+{
+public:
+    TransitionDeltas()
+    {
+        // Every slot starts out with the standard tuning, so all the differences are zero
+        DeltaSet& set(fSets.writeBuffer());
+        std::memset(&set, 0, sizeof(set));
+        fSets.fill(set);
+
+        std::memset(fBuilt, 0, sizeof(fBuilt));
+    }
+
+    // Worker side. Safe to call from several threads at once.
+    void rebuild(ScaleSlot* slots)
+    {
+        std::lock_guard<std::mutex> lock(fMutex);
+
+        for (int32_t i = 0; i < kScaleSlotCount; i++)
+            slots[i].copyBaked(fTables[i]);
+
+        bool changed = false;
+        for (int32_t i = 0; i < kScaleSlotCount; i++)
+            changed |= fTables[i].generation != fBuilt[i];
+        if (! changed)
+            return;
+
+        DeltaSet& set(fSets.writeBuffer());
+
+        for (int32_t from = 0; from < kScaleSlotCount; from++)
+        {
+            set.generations[from] = fBuilt[from] = fTables[from].generation;
+
+            for (int32_t to = 0; to < kScaleSlotCount; to++)
+            {
+                if (to == from)
+                    continue;
+
+                const int32_t pair = DeltaSet::pairIndex(from, to);
+                double largest = 0.0, largestLog2 = 0.0;
+                for (int32_t i = 0; i < kMidiNoteCount; i++)
+                {
+                    const double delta = fTables[to].frequencies[i] - fTables[from].frequencies[i];
+                    const double deltaLog2 = fTables[to].log2Frequencies[i] - fTables[from].log2Frequencies[i];
+                    set.hz[pair][i] = delta;
+                    set.log2[pair][i] = deltaLog2;
+                    largest = std::fmax(largest, std::fabs(delta));
+                    largestLog2 = std::fmax(largestLog2, std::fabs(deltaLog2));
+                }
+                set.largest[pair] = largest;
+                set.largestLog2[pair] = largestLog2;
+            }
+        }
+
+        fSets.publish();
+    }
+
+    /* Audio thread side */
+
+    bool acquire() noexcept
+    {
+        return fSets.acquire();
+    }
+
+    const DeltaSet& current() const noexcept
+    {
+        return fSets.readBuffer();
+    }
+
+private:
+    std::mutex fMutex;
+    ScaleTable fTables[kScaleSlotCount];
+    uint32_t fBuilt[kScaleSlotCount];
+    TripleBuffer<DeltaSet> fSets;
+
+    DISTRHO_DECLARE_NON_COPYABLE(TransitionDeltas)
+};
+
+END_NAMESPACE_DISTRHO
+
+#endif
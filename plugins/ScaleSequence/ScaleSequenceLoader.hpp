@@ -0,0 +1,303 @@
+#ifndef SCALESEQUENCE_LOADER_HPP
+#define SCALESEQUENCE_LOADER_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ScaleSequenceDeltas.hpp"
+#include "ScaleSequenceSlots.hpp"
+#include "ScaleSequenceWatcher.hpp"
+
+START_NAMESPACE_DISTRHO
+
+/**
+   Worker threads shared by every ScaleSequence instance in the process.
+   When a project with many instances is restored, setState only queues jobs here and the slots are parsed and baked
+   in parallel. Each slot publishes its own table as soon as its job is done.
+
+   Jobs for slots that the sequence references run first. The others wait at low priority, unless a step selects
+   one of them in the meantime.
+ */
+class ScaleLoaderPool
+{
+public:
+    // Called on the worker thread after a job has published a new table for @a owner
+    typedef void (*LoadedCallback)(void* owner);
+
+    // The pool is created with its first user and its threads are stopped when the last user goes away
+    static ScaleLoaderPool* retain()
+    {
+        std::lock_guard<std::mutex> lock(instanceMutex());
+        ScaleLoaderPool*& pool(instance());
+
+        if (pool == nullptr)
+            pool = new ScaleLoaderPool();
+
+        ++pool->fUsers;
+        return pool;
+    }
+
+    static void release()
+    {
+        std::lock_guard<std::mutex> lock(instanceMutex());
+        ScaleLoaderPool*& pool(instance());
+
+        if (pool != nullptr && --pool->fUsers == 0)
+        {
+            delete pool;
+            pool = nullptr;
+        }
+    }
+
+    void enqueue(void* owner, ScaleSlot* slot, bool referenced, LoadedCallback loaded)
+    {
+        {
+            std::lock_guard<std::mutex> lock(fMutex);
+
+            startWorkers();
+
+            // A queued job always loads the latest files, so one entry per slot is enough
+            if (! isQueued(slot))
+            {
+                const Job job = { owner, slot, loaded };
+                (referenced ? fUrgent : fDeferred).push_back(job);
+            }
+            else if (referenced)
+            {
+                promote(slot);
+            }
+        }
+        fCondition.notify_one();
+    }
+
+    // Drop every queued job of @a owner and wait for any that are already running
+    void cancel(const void* owner)
+    {
+        std::unique_lock<std::mutex> lock(fMutex);
+
+        const auto sameOwner = [owner](const Job& job) { return job.owner == owner; };
+        fUrgent.erase(std::remove_if(fUrgent.begin(), fUrgent.end(), sameOwner), fUrgent.end());
+        fDeferred.erase(std::remove_if(fDeferred.begin(), fDeferred.end(), sameOwner), fDeferred.end());
+
+        fIdle.wait(lock, [this, &sameOwner] {
+            return std::none_of(fBusy.begin(), fBusy.end(), sameOwner);
+        });
+    }
+
+private:
+    struct Job
+    {
+        void* owner;
+        ScaleSlot* slot;
+        LoadedCallback loaded;
+    };
+
+    enum {
+        // How long a deferred job waits, so an urgent or requested one can overtake it
+        kIdleLoadDelayMs = 20,
+        kMaxWorkers = 4
+    };
+
+    ScaleLoaderPool()
+        : fUsers(0),
+          fExit(false) {}
+
+    ~ScaleLoaderPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(fMutex);
+            fExit = true;
+        }
+        fCondition.notify_all();
+
+        for (std::thread& worker : fWorkers)
+            worker.join();
+    }
+
+    static std::mutex& instanceMutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static ScaleLoaderPool*& instance()
+    {
+        static ScaleLoaderPool* pool = nullptr;
+        return pool;
+    }
+
+    // Threads are only started once there is work, so instances that never load a file cost nothing
+    void startWorkers()
+    {
+        if (! fWorkers.empty())
+            return;
+
+        const uint32_t cores = std::thread::hardware_concurrency();
+        const uint32_t count = std::max(1u, std::min<uint32_t>(kMaxWorkers, cores / 2));
+
+        const Job none = { nullptr, nullptr, nullptr };
+        fBusy.assign(count, none);
+
+        for (uint32_t i = 0; i < count; i++)
+            fWorkers.emplace_back(&ScaleLoaderPool::process, this, i);
+    }
+
+    bool isQueued(const ScaleSlot* slot) const
+    {
+        for (const Job& job : fUrgent)
+            if (job.slot == slot)
+                return true;
+        for (const Job& job : fDeferred)
+            if (job.slot == slot)
+                return true;
+        return false;
+    }
+
+    void promote(const ScaleSlot* slot)
+    {
+        for (auto it = fDeferred.begin(); it != fDeferred.end(); ++it)
+        {
+            if (it->slot == slot)
+            {
+                fUrgent.push_back(*it);
+                fDeferred.erase(it);
+                return;
+            }
+        }
+    }
+
+    // Urgent jobs first, then deferred slots that a step has asked for, then (if allowed) any deferred slot
+    bool takeJob(Job& job, bool anyDeferred)
+    {
+        if (! fUrgent.empty())
+        {
+            job = fUrgent.front();
+            fUrgent.pop_front();
+            return true;
+        }
+
+        for (auto it = fDeferred.begin(); it != fDeferred.end(); ++it)
+        {
+            if (anyDeferred || it->slot->isRequested())
+            {
+                job = *it;
+                fDeferred.erase(it);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void process(uint32_t index)
+    {
+        std::unique_lock<std::mutex> lock(fMutex);
+
+        while (! fExit)
+        {
+            Job job;
+
+            if (! takeJob(job, false))
+            {
+                if (fDeferred.empty())
+                {
+                    fCondition.wait(lock);
+                    continue;
+                }
+
+                fCondition.wait_for(lock, std::chrono::milliseconds(kIdleLoadDelayMs));
+                if (fExit || ! takeJob(job, true))
+                    continue;
+            }
+
+            fBusy[index] = job;
+            lock.unlock();
+
+            if (job.slot->load() && job.loaded != nullptr)
+                job.loaded(job.owner);
+
+            lock.lock();
+            fBusy[index].owner = nullptr;
+            fBusy[index].slot = nullptr;
+            fIdle.notify_all();
+        }
+    }
+
+    uint32_t fUsers;
+    bool fExit;
+
+    std::mutex fMutex;
+    std::condition_variable fCondition;
+    std::condition_variable fIdle;
+    std::deque<Job> fUrgent;
+    std::deque<Job> fDeferred;
+    std::vector<Job> fBusy;
+    std::vector<std::thread> fWorkers;
+};
+
+/**
+   One instance's handle on the shared pool and file watcher.
+   Destroying it cancels the instance's pending jobs, so slots are never loaded after their plugin has gone.
+ */
+class ScaleLoader
+{
+public:
+    ScaleLoader(ScaleSlot* slots, TransitionDeltas& deltas)
+        : fSlots(slots),
+          fDeltas(deltas),
+          fPool(ScaleLoaderPool::retain()),
+          fWatcher(ScaleFileWatcher::retain()) {}
+
+    ~ScaleLoader()
+    {
+        fWatcher->unwatch(this);
+        fPool->cancel(this);
+        ScaleFileWatcher::release();
+        ScaleLoaderPool::release();
+    }
+
+    // Queue the slot after its files have been set, and watch the new files for edits
+    void schedule(int32_t slot, bool referenced)
+    {
+        std::string scl, kbm;
+        fSlots[slot].getFiles(scl, kbm);
+
+        fWatcher->watch(this, slot, reloadSlot, scl, kbm);
+        fPool->enqueue(this, &fSlots[slot], referenced, slotLoaded);
+    }
+
+private:
+    // Called by the watcher when a file of the slot has been saved
+    static void reloadSlot(void* owner, int32_t slot)
+    {
+        ScaleLoader* const self = static_cast<ScaleLoader*>(owner);
+
+        self->fSlots[slot].reload();
+        self->fPool->enqueue(self, &self->fSlots[slot], true, slotLoaded);
+    }
+
+    // Called by the pool when a slot has a new table, so the differences between slots are ready before a step needs them
+    static void slotLoaded(void* owner)
+    {
+        ScaleLoader* const self = static_cast<ScaleLoader*>(owner);
+
+        self->fDeltas.rebuild(self->fSlots);
+    }
+
+    ScaleSlot* const fSlots;
+    TransitionDeltas& fDeltas;
+    ScaleLoaderPool* const fPool;
+    ScaleFileWatcher* const fWatcher;
+
+    DISTRHO_DECLARE_NON_COPYABLE(ScaleLoader)
+};
+
+END_NAMESPACE_DISTRHO
+
+#endif
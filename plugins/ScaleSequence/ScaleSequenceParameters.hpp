@@ -0,0 +1,65 @@
+#ifndef SCALESEQUENCE_PARAMETERS_HPP
+#define SCALESEQUENCE_PARAMETERS_HPP
+
+#include <atomic>
+
+#include "ScaleSequenceControls.hpp"
+
+static const size_t kCacheLineSize = 64;
+
+static inline bool isOutputParameter(uint32_t index)
+{
+    return index == kParameterCurrentStep || index == kParameterPublishLatency;
+}
+
+/**
+   Parameter values shared between the host threads and run().
+   Every value is a relaxed atomic, so the host may read or write any of them from any thread while run() is going.
+   Host-written inputs and the outputs written by run() are kept on separate cache lines, padded rather than
+   over-aligned so this also holds for plugins allocated with plain new.
+ */
+class ParameterStore
+{
+public:
+    ParameterStore()
+    {
+        for (uint32_t i = 0; i < kParameterCount; i++)
+        {
+            fInputs[i].store(ParameterDefaults[i], std::memory_order_relaxed);
+            fOutputs[i].store(ParameterDefaults[i], std::memory_order_relaxed);
+        }
+    }
+
+    float get(uint32_t index) const noexcept
+    {
+        return (isOutputParameter(index) ? fOutputs : fInputs)[index].load(std::memory_order_relaxed);
+    }
+
+    // Host side, for parameter inputs
+    void set(uint32_t index, float value) noexcept
+    {
+        fInputs[index].store(value, std::memory_order_relaxed);
+    }
+
+    // run() side, for parameter outputs
+    void setOutput(uint32_t index, float value) noexcept
+    {
+        fOutputs[index].store(value, std::memory_order_relaxed);
+    }
+
+    // Copy every value once, so a block works with one set of parameters from start to end
+    void snapshot(float values[kParameterCount]) const noexcept
+    {
+        for (uint32_t i = 0; i < kParameterCount; i++)
+            values[i] = get(i);
+    }
+
+private:
+    char fPadBefore[kCacheLineSize];
+    std::atomic<float> fInputs[kParameterCount];
+    char fPadBetween[kCacheLineSize];
+    std::atomic<float> fOutputs[kParameterCount];
+    char fPadAfter[kCacheLineSize];
+};
+
+#endif
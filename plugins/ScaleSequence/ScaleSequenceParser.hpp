@@ -0,0 +1,533 @@
+#ifndef SCALESEQUENCE_PARSER_HPP
+#define SCALESEQUENCE_PARSER_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include "DistrhoUtils.hpp"
+#include "ScaleSequenceArena.hpp"
+#include "Tunings.h"
+
+START_NAMESPACE_DISTRHO
+
+/*
+   SCL/KBM parser working directly on a file already in memory.
+   Unlike Tunings::readSCLFile/readKBMFile it never throws: problems are reported through ParseResult.
+   Lines are walked in place, and the file contents and tone or key lists all come from a MonotonicArena.
+ */
+
+enum ParseStatus {
+    kParseOk = 0,
+    kParseCannotRead,
+    kParseMissingCount,
+    kParseBadCount,
+    kParseBadTone,
+    kParseMissingTones,
+    kParseBadField,
+    kParseMissingFields,
+    kParseBadKey,
+    kParseMissingKeys,
+    kParseNoMemory
+};
+
+struct ParseResult
+{
+    ParseStatus status;
+    int32_t line;
+
+    bool ok() const noexcept
+    {
+        return status == kParseOk;
+    }
+};
+
+inline const char* parseStatusText(ParseStatus status) noexcept
+{
+    switch (status)
+    {
+    case kParseOk:            return "OK";
+    case kParseCannotRead:    return "Unable to read file";
+    case kParseMissingCount:  return "Missing note count";
+    case kParseBadCount:      return "Invalid note count";
+    case kParseBadTone:       return "Invalid tone";
+    case kParseMissingTones:  return "Read fewer notes than count";
+    case kParseBadField:      return "Invalid KBM header field";
+    case kParseMissingFields: return "Incomplete KBM header";
+    case kParseBadKey:        return "Invalid KBM key";
+    case kParseMissingKeys:   return "Read fewer keys than map size";
+    case kParseNoMemory:      return "Out of memory";
+    }
+    return "Unknown error";
+}
+
+// Non-owning range of characters inside the file buffer
+struct TextView
+{
+    const char* begin;
+    const char* end;
+
+    bool empty() const noexcept { return begin == end; }
+};
+
+inline bool isBlank(char c) noexcept
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f' || c == '\v';
+}
+
+inline TextView trimmed(TextView v) noexcept
+{
+    while (v.begin != v.end && isBlank(*v.begin))
+        ++v.begin;
+    while (v.end != v.begin && isBlank(*(v.end - 1)))
+        --v.end;
+    return v;
+}
+
+// First whitespace separated token, anything after it is a comment
+inline TextView firstToken(TextView v) noexcept
+{
+    v = trimmed(v);
+    const char* p = v.begin;
+    while (p != v.end && ! isBlank(*p))
+        ++p;
+    v.end = p;
+    return v;
+}
+
+// Walks the lines of a buffer, skipping "!" comments
+class LineReader
+{
+public:
+    LineReader(const char* data, size_t size) noexcept
+        : fPos(data),
+          fEnd(data + size),
+          fLine(0),
+          fReturn(false) {}
+
+    bool next(TextView& line) noexcept
+    {
+        while (fPos != fEnd)
+        {
+            line.begin = fPos;
+            while (fPos != fEnd && *fPos != '\n')
+                ++fPos;
+            line.end = fPos;
+            if (fPos != fEnd)
+                ++fPos;
+            ++fLine;
+
+            fReturn = line.end != line.begin && *(line.end - 1) == '\r';
+            if (fReturn)
+                --line.end;
+            if (line.begin != line.end && *line.begin == '!')
+                continue;
+
+            return true;
+        }
+        return false;
+    }
+
+    int32_t lineNumber() const noexcept
+    {
+        return fLine;
+    }
+
+    // Whether the last line ended in a carriage return, which next() leaves out
+    bool hadReturn() const noexcept
+    {
+        return fReturn;
+    }
+
+private:
+    const char* fPos;
+    const char* const fEnd;
+    int32_t fLine;
+    bool fReturn;
+};
+
+inline bool parseInteger(TextView v, int64_t& value) noexcept
+{
+    bool negative = false;
+    if (v.begin != v.end && (*v.begin == '-' || *v.begin == '+'))
+        negative = *v.begin++ == '-';
+    if (v.empty())
+        return false;
+
+    int64_t result = 0;
+    for (const char* p = v.begin; p != v.end; ++p)
+    {
+        if (*p < '0' || *p > '9' || result > (INT64_MAX - 9) / 10)
+            return false;
+        result = result * 10 + (*p - '0');
+    }
+
+    value = negative ? -result : result;
+    return true;
+}
+
+/**
+   Locale independent decimal reader.
+   A mantissa of up to 2^53 with a power of ten up to 10^22 is exact in a double, so one multiply or divide rounds
+   the same as strtod in the "C" locale. That covers every value found in Scala files in practice. Anything longer
+   is handed to strtod as digits and an exponent, with no decimal point for the locale to get wrong.
+ */
+inline bool parseDecimal(TextView v, double& value) noexcept
+{
+    static const double kPowersOfTen[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    static const uint64_t kExactMantissa = uint64_t(1) << 53;
+    // More significant digits than a double can ever need to round correctly
+    static const int32_t kMaxDigits = 780;
+
+    bool negative = false;
+    if (v.begin != v.end && (*v.begin == '-' || *v.begin == '+'))
+        negative = *v.begin++ == '-';
+
+    // The significant digits, and the power of ten that follows the last of them
+    char digits[kMaxDigits + 24];
+    int32_t count = 0, exponent = 0;
+    bool seenDigit = false, seenPoint = false, truncated = false;
+
+    const char* p = v.begin;
+    for (; p != v.end; ++p)
+    {
+        if (*p == '.' && ! seenPoint)
+        {
+            seenPoint = true;
+            continue;
+        }
+        if (*p < '0' || *p > '9')
+            break;
+
+        seenDigit = true;
+        if (count == 0 && *p == '0')
+        {
+            if (seenPoint)
+                --exponent;
+        }
+        else if (count < kMaxDigits)
+        {
+            digits[count++] = *p;
+            if (seenPoint)
+                --exponent;
+        }
+        else
+        {
+            // Past the limit only whether anything is left over matters
+            truncated |= *p != '0';
+            if (! seenPoint)
+                ++exponent;
+        }
+    }
+
+    if (! seenDigit)
+        return false;
+
+    if (p != v.end && (*p == 'e' || *p == 'E'))
+    {
+        int64_t e;
+        TextView ev = { p + 1, v.end };
+        if (! parseInteger(ev, e) || e < -400 || e > 400)
+            return false;
+        exponent += static_cast<int32_t>(e);
+    }
+    else if (p != v.end)
+    {
+        return false;
+    }
+
+    uint64_t mantissa = 0;
+    for (int32_t i = 0; i < count && mantissa <= kExactMantissa; i++)
+        mantissa = mantissa * 10 + static_cast<uint64_t>(digits[i] - '0');
+
+    double result;
+    if (count == 0)
+    {
+        result = 0.0;
+    }
+    else if (mantissa <= kExactMantissa && exponent >= -22 && exponent <= 22)
+    {
+        result = static_cast<double>(mantissa);
+        result = exponent < 0 ? result / kPowersOfTen[-exponent] : result * kPowersOfTen[exponent];
+    }
+    else
+    {
+        // A nonzero digit standing in for the ones dropped keeps the rounding direction
+        if (truncated)
+        {
+            digits[count++] = '1';
+            --exponent;
+        }
+        std::snprintf(digits + count, sizeof(digits) - static_cast<size_t>(count), "e%d", exponent);
+        result = std::strtod(digits, nullptr);
+    }
+
+    value = negative ? -result : result;
+    return true;
+}
+
+/**
+   Tunings::readKBMStream only takes header and key lines made of digits, spaces and '.', or a key of exactly "x".
+   It reads anything else, even an empty line, as an error.
+ */
+inline bool isKbmLine(TextView v) noexcept
+{
+    if (v.empty())
+        return false;
+
+    for (const char* p = v.begin; p != v.end; ++p)
+        if (*p != ' ' && *p != '.' && (*p < '0' || *p > '9'))
+            return false;
+    return true;
+}
+
+inline bool contains(TextView v, char c) noexcept
+{
+    for (const char* p = v.begin; p != v.end; ++p)
+        if (*p == c)
+            return true;
+    return false;
+}
+
+// One SCL tone as read from the file
+struct ToneData
+{
+    double cents;
+    int64_t ratioN, ratioD;
+    bool isRatio;
+    int32_t line;
+};
+
+// Parsed SCL file. All pointers refer to arena memory.
+struct ScaleData
+{
+    TextView description;
+    int32_t count;
+    ToneData* tones;
+};
+
+// Parsed KBM file. All pointers refer to arena memory.
+struct MappingData
+{
+    int32_t count, firstMidi, lastMidi, middleNote, tuningConstantNote, octaveDegrees;
+    double tuningFrequency;
+    int32_t* keys;
+};
+
+// Same rules as Tunings::toneFromString: a "." means cents, otherwise a ratio or a whole number
+inline bool parseTone(TextView line, int32_t lineno, ToneData& tone) noexcept
+{
+    const TextView token = firstToken(line);
+    if (token.empty())
+        return false;
+
+    tone.line = lineno;
+
+    if (contains(token, '.'))
+    {
+        double cents;
+        if (! parseDecimal(token, cents))
+            return false;
+
+        tone.isRatio = false;
+        tone.cents = cents;
+        tone.ratioN = tone.ratioD = 1;
+    }
+    else
+    {
+        int64_t n, d = 1;
+        const char* slash = token.begin;
+        while (slash != token.end && *slash != '/')
+            ++slash;
+
+        TextView nv = { token.begin, slash };
+        if (! parseInteger(nv, n))
+            return false;
+        if (slash != token.end)
+        {
+            TextView dv = { slash + 1, token.end };
+            if (! parseInteger(dv, d))
+                return false;
+        }
+        if (n <= 0 || d <= 0)
+            return false;
+
+        tone.isRatio = true;
+        tone.ratioN = n;
+        tone.ratioD = d;
+        tone.cents = 1200.0 * std::log(1.0 * n / d) / std::log(2.0);
+    }
+
+    return true;
+}
+
+/**
+   Parse SCL data into @a scale, taking the tone list from @a arena.
+   The description points into @a data, which must outlive the result.
+ */
+inline ParseResult parseScl(const char* data, size_t size, MonotonicArena& arena, ScaleData& scale) noexcept
+{
+    LineReader reader(data, size);
+    TextView line;
+
+    if (! reader.next(line))
+        return { kParseMissingCount, reader.lineNumber() };
+    const TextView description = line;
+
+    if (! reader.next(line))
+        return { kParseMissingCount, reader.lineNumber() };
+
+    int64_t count;
+    if (! parseInteger(firstToken(line), count) || count < 1 || count > 4096)
+        return { kParseBadCount, reader.lineNumber() };
+
+    ToneData* const tones = arena.allocateArray<ToneData>(static_cast<size_t>(count));
+    if (tones == nullptr)
+        return { kParseNoMemory, reader.lineNumber() };
+
+    for (int64_t i = 0; i < count; i++)
+    {
+        // Empty lines between tones are skipped, as Tunings::readSCLStream does. A line of spaces, or a lone carriage
+        // return (which the reader has already taken off), is read as a tone there and rejected.
+        do
+        {
+            if (! reader.next(line))
+                return { kParseMissingTones, reader.lineNumber() };
+        } while (line.empty() && ! reader.hadReturn());
+
+        if (! parseTone(line, reader.lineNumber(), tones[i]))
+            return { kParseBadTone, reader.lineNumber() };
+    }
+
+    scale.description = description;
+    scale.count = static_cast<int32_t>(count);
+    scale.tones = tones;
+    return { kParseOk, 0 };
+}
+
+/**
+   Parse KBM data into @a mapping, taking the key list from @a arena.
+ */
+inline ParseResult parseKbm(const char* data, size_t size, MonotonicArena& arena, MappingData& mapping) noexcept
+{
+    enum Field { kMapSize, kFirstMidi, kLastMidi, kMiddle, kReference, kFrequency, kOctaveDegree, kFieldCount };
+
+    LineReader reader(data, size);
+    TextView line;
+    int64_t fields[kFieldCount] = {};
+    double frequency = 0.0;
+
+    for (int32_t f = 0; f < kFieldCount; f++)
+    {
+        if (! reader.next(line))
+            return { kParseMissingFields, reader.lineNumber() };
+        if (! isKbmLine(line))
+            return { kParseBadField, reader.lineNumber() };
+        line = firstToken(line);
+
+        const bool valid = (f == kFrequency) ? parseDecimal(line, frequency) && frequency > 0.0
+                                             : parseInteger(line, fields[f]);
+        if (! valid)
+            return { kParseBadField, reader.lineNumber() };
+    }
+
+    if (fields[kMapSize] < 0 || fields[kMapSize] > 2048 || fields[kOctaveDegree] < 0 || fields[kOctaveDegree] > 4096)
+        return { kParseBadField, 0 };
+    for (int32_t f = kFirstMidi; f <= kReference; f++)
+        if (fields[f] < 0 || fields[f] > 127)
+            return { kParseBadField, 0 };
+
+    const int32_t count = static_cast<int32_t>(fields[kMapSize]);
+    int32_t* const keys = arena.allocateArray<int32_t>(static_cast<size_t>(count));
+    if (keys == nullptr && count > 0)
+        return { kParseNoMemory, reader.lineNumber() };
+
+    for (int32_t i = 0; i < count; i++)
+    {
+        if (! reader.next(line))
+            return { kParseMissingKeys, reader.lineNumber() };
+
+        int64_t key;
+        if (line.end - line.begin == 1 && *line.begin == 'x' && ! reader.hadReturn())
+            key = -1;
+        else if (! isKbmLine(line) || ! parseInteger(firstToken(line), key) || key > 4096)
+            return { kParseBadKey, reader.lineNumber() };
+
+        keys[i] = static_cast<int32_t>(key);
+    }
+
+    mapping.count = count;
+    mapping.firstMidi = static_cast<int32_t>(fields[kFirstMidi]);
+    mapping.lastMidi = static_cast<int32_t>(fields[kLastMidi]);
+    mapping.middleNote = static_cast<int32_t>(fields[kMiddle]);
+    mapping.tuningConstantNote = static_cast<int32_t>(fields[kReference]);
+    mapping.tuningFrequency = frequency;
+    mapping.octaveDegrees = static_cast<int32_t>(fields[kOctaveDegree]);
+    mapping.keys = keys;
+    return { kParseOk, 0 };
+}
+
+// Copy a parsed scale into the form Tunings::Tuning wants. Tone string representations are not kept.
+inline void toTuningScale(const ScaleData& data, Tunings::Scale& scale)
+{
+    scale.description.assign(data.description.begin, data.description.end);
+    scale.count = data.count;
+    scale.tones.resize(static_cast<size_t>(data.count));
+
+    for (int32_t i = 0; i < data.count; i++)
+    {
+        const ToneData& src(data.tones[i]);
+        Tunings::Tone& tone(scale.tones[static_cast<size_t>(i)]);
+        tone.type = src.isRatio ? Tunings::Tone::kToneRatio : Tunings::Tone::kToneCents;
+        tone.cents = src.cents;
+        tone.ratio_n = src.ratioN;
+        tone.ratio_d = src.ratioD;
+        tone.floatValue = src.cents / 1200.0 + 1.0;
+        tone.lineno = src.line;
+    }
+}
+
+inline void toTuningMapping(const MappingData& data, Tunings::KeyboardMapping& mapping)
+{
+    mapping.count = data.count;
+    mapping.firstMidi = data.firstMidi;
+    mapping.lastMidi = data.lastMidi;
+    mapping.middleNote = data.middleNote;
+    mapping.tuningConstantNote = data.tuningConstantNote;
+    mapping.tuningFrequency = data.tuningFrequency;
+    mapping.tuningPitch = data.tuningFrequency / Tunings::MIDI_0_FREQ;
+    mapping.octaveDegrees = data.octaveDegrees;
+    mapping.keys.assign(data.keys, data.keys + data.count);
+}
+
+// Read a whole file into arena memory. Returns false if the file cannot be read.
+inline bool readFileContents(const char* filename, MonotonicArena& arena, TextView& contents) noexcept
+{
+    std::FILE* const file = std::fopen(filename, "rb");
+    if (file == nullptr)
+        return false;
+
+    bool ok = std::fseek(file, 0, SEEK_END) == 0;
+    const long size = ok ? std::ftell(file) : -1;
+    ok = size >= 0 && std::fseek(file, 0, SEEK_SET) == 0;
+
+    char* const buffer = ok ? static_cast<char*>(arena.allocate(static_cast<size_t>(size) + 1, 1)) : nullptr;
+    ok = buffer != nullptr && std::fread(buffer, 1, static_cast<size_t>(size), file) == static_cast<size_t>(size);
+
+    std::fclose(file);
+
+    if (ok)
+    {
+        contents.begin = buffer;
+        contents.end = buffer + size;
+    }
+    return ok;
+}
+
+END_NAMESPACE_DISTRHO
+
+#endif
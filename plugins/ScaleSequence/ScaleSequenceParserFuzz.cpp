@@ -0,0 +1,284 @@
+/*
+   Differential fuzz target for the SCL/KBM parser in ScaleSequenceParser.hpp, checked against
+   Tunings::readSCLStream and Tunings::readKBMStream from the tuning-library submodule. It is not part of the plugin,
+   and is built with the SCALESEQUENCE_BUILD_TOOLS option:
+
+     cmake -S . -B build -DSCALESEQUENCE_BUILD_TOOLS=ON
+     cmake --build build --target scalesequence_parser_fuzz
+     ./build/scalesequence_parser_fuzz
+
+   With clang it is a libFuzzer target. Other compilers get the small driver at the end of this file, which runs the
+   files given on the command line, or else a million random inputs.
+
+   The first byte of each input picks one of four modes:
+   - Raw SCL or KBM bytes. The two parsers may disagree about rejecting junk, as the library reads numbers with
+     atoi/atof and takes "12abc" as 12, but anything parseScl/parseKbm accepts must be accepted by the library with
+     the same values.
+   - A file generated from the rest of the input out of well-formed pieces: tones or keys, comments, blank lines (SCL
+     only) and trailing text. Both parsers have to agree on these exactly, accepting or rejecting the same files.
+   Any disagreement aborts with both results printed.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <string>
+
+#include "ScaleSequenceParser.hpp"
+
+USE_NAMESPACE_DISTRHO
+
+namespace {
+
+// Reads choices from the fuzz input, returning 0 once it runs out
+class Choices
+{
+public:
+    Choices(const uint8_t* data, size_t size)
+        : fData(data),
+          fSize(size),
+          fPos(0) {}
+
+    uint32_t next(uint32_t range)
+    {
+        return fPos < fSize ? fData[fPos++] % range : 0;
+    }
+
+    bool empty() const
+    {
+        return fPos >= fSize;
+    }
+
+private:
+    const uint8_t* fData;
+    size_t fSize;
+    size_t fPos;
+};
+
+void fail(const char* what, const std::string& text)
+{
+    std::fprintf(stderr, "ScaleSequence parser mismatch: %s\n--- input ---\n%s\n--- end ---\n", what, text.c_str());
+    std::abort();
+}
+
+bool same(double a, double b)
+{
+    return std::fabs(a - b) <= 1e-9 * std::fmax(1.0, std::fabs(b));
+}
+
+void checkScl(const std::string& text, bool mustAgree)
+{
+    alignas(std::max_align_t) char initial[4096];
+    MonotonicArena arena(initial, sizeof(initial));
+    ScaleData data;
+    const bool ours = parseScl(text.data(), text.size(), arena, data).ok();
+
+    Tunings::Scale scale;
+    bool theirs = true;
+    try
+    {
+        std::istringstream stream(text);
+        scale = Tunings::readSCLStream(stream);
+    }
+    catch (const Tunings::TuningError&)
+    {
+        theirs = false;
+    }
+
+    if (ours && ! theirs)
+        fail("SCL accepted by parseScl, rejected by readSCLStream", text);
+    if (mustAgree && theirs && ! ours)
+        fail("SCL accepted by readSCLStream, rejected by parseScl", text);
+    if (! ours || ! theirs)
+        return;
+
+    if (data.count != scale.count || static_cast<size_t>(data.count) != scale.tones.size())
+        fail("SCL tone count", text);
+
+    for (int32_t i = 0; i < data.count; i++)
+    {
+        const ToneData& tone(data.tones[i]);
+        const Tunings::Tone& expected(scale.tones[static_cast<size_t>(i)]);
+
+        if (tone.isRatio != (expected.type == Tunings::Tone::kToneRatio) || ! same(tone.cents, expected.cents))
+            fail("SCL tone value", text);
+        if (tone.isRatio && (tone.ratioN != expected.ratio_n || tone.ratioD != expected.ratio_d))
+            fail("SCL tone ratio", text);
+    }
+}
+
+void checkKbm(const std::string& text, bool mustAgree)
+{
+    alignas(std::max_align_t) char initial[4096];
+    MonotonicArena arena(initial, sizeof(initial));
+    MappingData data;
+    const bool ours = parseKbm(text.data(), text.size(), arena, data).ok();
+
+    Tunings::KeyboardMapping mapping;
+    bool theirs = true;
+    try
+    {
+        std::istringstream stream(text);
+        mapping = Tunings::readKBMStream(stream);
+    }
+    catch (const Tunings::TuningError&)
+    {
+        theirs = false;
+    }
+
+    if (ours && ! theirs)
+        fail("KBM accepted by parseKbm, rejected by readKBMStream", text);
+    if (mustAgree && theirs && ! ours)
+        fail("KBM accepted by readKBMStream, rejected by parseKbm", text);
+    if (! ours || ! theirs)
+        return;
+
+    if (data.count != mapping.count || data.firstMidi != mapping.firstMidi || data.lastMidi != mapping.lastMidi
+        || data.middleNote != mapping.middleNote || data.tuningConstantNote != mapping.tuningConstantNote
+        || ! same(data.tuningFrequency, mapping.tuningFrequency) || data.octaveDegrees != mapping.octaveDegrees)
+        fail("KBM header", text);
+
+    if (static_cast<size_t>(data.count) != mapping.keys.size())
+        fail("KBM key count", text);
+
+    for (int32_t i = 0; i < data.count; i++)
+        if (data.keys[i] != mapping.keys[static_cast<size_t>(i)])
+            fail("KBM key", text);
+}
+
+// Lines that both parsers skip. The KBM reader in tuning-library only skips comments, not blank lines.
+void addFiller(Choices& choices, std::string& text, bool blankLines)
+{
+    while (! choices.empty() && choices.next(4) == 0)
+        text += blankLines && choices.next(2) == 0 ? "\n" : "! comment\n";
+}
+
+// Text that both parsers ignore after the value. For KBM lines, only spaces.
+const char* trailing(Choices& choices, bool anyText)
+{
+    static const char* const kTrailing[] = { "", " ", "  ", "\t", "  ! note", " cents" };
+    return kTrailing[choices.next(anyText ? 6 : 3)];
+}
+
+std::string generateScl(Choices& choices)
+{
+    std::string text;
+    addFiller(choices, text, true);
+    text += "Fuzzed scale\n";
+    addFiller(choices, text, true);
+
+    // Sometimes promise more tones than are given
+    const uint32_t count = 1 + choices.next(12);
+    const uint32_t given = choices.next(8) == 0 ? choices.next(count) : count;
+    text += std::to_string(count) + "\n";
+
+    for (uint32_t i = 0; i < given; i++)
+    {
+        addFiller(choices, text, true);
+
+        char tone[64];
+        switch (choices.next(3))
+        {
+        case 0:
+            std::snprintf(tone, sizeof(tone), "%u.%u", choices.next(2400), choices.next(1000));
+            break;
+        case 1:
+            std::snprintf(tone, sizeof(tone), "%u/%u", 1 + choices.next(255), 1 + choices.next(255));
+            break;
+        default:
+            std::snprintf(tone, sizeof(tone), "%u", 1 + choices.next(16));
+            break;
+        }
+        text += tone;
+        text += trailing(choices, true);
+        text += "\n";
+    }
+
+    return text;
+}
+
+std::string generateKbm(Choices& choices)
+{
+    const uint32_t count = choices.next(13);
+    const uint32_t given = choices.next(8) == 0 ? choices.next(count + 1) : count;
+
+    char header[128];
+    std::snprintf(header, sizeof(header), "%u\n%u\n%u\n%u\n%u\n%u.%u\n%u\n", count, choices.next(128),
+                  choices.next(128), choices.next(128), choices.next(128), 1 + choices.next(999), choices.next(100),
+                  choices.next(13));
+
+    std::string text;
+    addFiller(choices, text, false);
+    for (const char* p = header; *p != '\0'; ++p)
+    {
+        text += *p;
+        if (*p == '\n')
+            addFiller(choices, text, false);
+    }
+
+    for (uint32_t i = 0; i < given; i++)
+    {
+        addFiller(choices, text, false);
+        text += choices.next(6) == 0 ? "x" : std::to_string(choices.next(13));
+        text += trailing(choices, false);
+        text += "\n";
+    }
+
+    return text;
+}
+
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    if (size == 0)
+        return 0;
+
+    const std::string raw(reinterpret_cast<const char*>(data + 1), size - 1);
+    Choices choices(data + 1, size - 1);
+
+    switch (data[0] % 4)
+    {
+    case 0: checkScl(raw, false); break;
+    case 1: checkKbm(raw, false); break;
+    case 2: checkScl(generateScl(choices), true); break;
+    case 3: checkKbm(generateKbm(choices), true); break;
+    }
+
+    return 0;
+}
+
+#ifdef SCALESEQUENCE_FUZZ_STANDALONE
+int main(int argc, char** argv)
+{
+    if (argc > 1)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            std::ifstream file(argv[i], std::ios::binary);
+            const std::string input((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t*>(input.data()), input.size());
+        }
+        return 0;
+    }
+
+    // Mostly characters that mean something to the parsers, so random inputs get past the first line
+    static const char kAlphabet[] = "0123456789./!x \n\t-+eE";
+    std::mt19937 random(1);
+
+    for (int run = 0; run < 1000000; run++)
+    {
+        std::string input(random() % 256, '\0');
+        for (char& c : input)
+            c = run % 4 == 0 ? static_cast<char>(random()) : kAlphabet[random() % (sizeof(kAlphabet) - 1)];
+        LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t*>(input.data()), input.size());
+    }
+
+    std::printf("1000000 random inputs, no mismatches\n");
+    return 0;
+}
+#endif
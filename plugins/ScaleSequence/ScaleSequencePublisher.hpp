@@ -0,0 +1,463 @@
+#ifndef SCALESEQUENCE_PUBLISHER_HPP
+#define SCALESEQUENCE_PUBLISHER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "libMTSMaster.h"
+#include "ScaleSequenceSlots.hpp"
+
+#ifdef DISTRHO_OS_WINDOWS
+# ifndef NOMINMAX
+#  define NOMINMAX
+# endif
+# include <windows.h>
+#elif defined(DISTRHO_OS_MAC)
+# include <dispatch/dispatch.h>
+# include <pthread.h>
+# include <sched.h>
+#else
+# include <cerrno>
+# include <pthread.h>
+# include <sched.h>
+# include <semaphore.h>
+#endif
+
+START_NAMESPACE_DISTRHO
+
+enum {
+    // Below this many changed notes, they are sent one at a time rather than as a whole table. Measured with the
+    // publish benchmark against a stand-in for libMTS: the whole table took 22-27 ns, 8 notes one at a time 15-18 ns,
+    // 12 notes 22-31 ns and 16 notes 28-42 ns.
+    kSingleNoteCrossover = 12
+};
+
+// The two ways sendTuning() sends: the @a count notes listed in @a notes one at a time, or the whole table
+inline void sendNotes(const double* frequencies, double* published, const uint8_t* notes, int32_t count) noexcept
+{
+    for (int32_t n = 0; n < count; n++)
+    {
+        const uint8_t i = notes[n];
+        MTS_SetNoteTuning(frequencies[i], static_cast<char>(i));
+        published[i] = frequencies[i];
+    }
+}
+
+inline void sendTable(const double* frequencies, double* published) noexcept
+{
+    MTS_SetNoteTunings(frequencies);
+    std::memcpy(published, frequencies, sizeof(double) * kMidiNoteCount);
+}
+
+/**
+   Send @a frequencies to MTS-ESP clients. Only the notes that differ from @a published are sent, one by one if there
+   are only a few of them, or else the whole table in one go. Without a valid @a published, everything is sent.
+ */
+inline void sendTuning(const double* frequencies, double* published, bool& valid) noexcept
+{
+    int32_t changed = 0;
+    uint8_t notes[kMidiNoteCount];
+
+    if (valid)
+    {
+        for (int32_t i = 0; i < kMidiNoteCount; i++)
+        {
+            if (frequencies[i] != published[i])
+                notes[changed++] = static_cast<uint8_t>(i);
+        }
+    }
+
+    if (! valid || changed >= kSingleNoteCrossover)
+    {
+        sendTable(frequencies, published);
+        valid = true;
+        return;
+    }
+
+    sendNotes(frequencies, published, notes, changed);
+}
+
+// A table handed from run() to the publisher thread
+struct TuningSnapshot
+{
+    double frequencies[kMidiNoteCount];
+    // Clients have been sent something else in the meantime, so every note has to go out again
+    bool resend;
+    std::chrono::steady_clock::time_point written;
+};
+
+/**
+   A counting semaphore the audio thread can post to: posting never blocks or takes a lock.
+ */
+class PublisherSemaphore
+{
+public:
+    PublisherSemaphore()
+    {
+#if defined(DISTRHO_OS_WINDOWS)
+        fHandle = CreateSemaphoreW(nullptr, 0, LONG_MAX, nullptr);
+#elif defined(DISTRHO_OS_MAC)
+        fHandle = dispatch_semaphore_create(0);
+#else
+        sem_init(&fHandle, 0, 0);
+#endif
+    }
+
+    ~PublisherSemaphore()
+    {
+#if defined(DISTRHO_OS_WINDOWS)
+        CloseHandle(fHandle);
+#elif defined(DISTRHO_OS_MAC)
+        dispatch_release(fHandle);
+#else
+        sem_destroy(&fHandle);
+#endif
+    }
+
+    void post() noexcept
+    {
+#if defined(DISTRHO_OS_WINDOWS)
+        ReleaseSemaphore(fHandle, 1, nullptr);
+#elif defined(DISTRHO_OS_MAC)
+        dispatch_semaphore_signal(fHandle);
+#else
+        sem_post(&fHandle);
+#endif
+    }
+
+    void wait() noexcept
+    {
+#if defined(DISTRHO_OS_WINDOWS)
+        WaitForSingleObject(fHandle, INFINITE);
+#elif defined(DISTRHO_OS_MAC)
+        dispatch_semaphore_wait(fHandle, DISPATCH_TIME_FOREVER);
+#else
+        while (sem_wait(&fHandle) != 0 && errno == EINTR) {}
+#endif
+    }
+
+    // Take back every post still counted, as one pass serves them all
+    void drain() noexcept
+    {
+#if defined(DISTRHO_OS_WINDOWS)
+        while (WaitForSingleObject(fHandle, 0) == WAIT_OBJECT_0) {}
+#elif defined(DISTRHO_OS_MAC)
+        while (dispatch_semaphore_wait(fHandle, DISPATCH_TIME_NOW) == 0) {}
+#else
+        while (sem_trywait(&fHandle) == 0) {}
+#endif
+    }
+
+private:
+#if defined(DISTRHO_OS_WINDOWS)
+    HANDLE fHandle;
+#elif defined(DISTRHO_OS_MAC)
+    dispatch_semaphore_t fHandle;
+#else
+    sem_t fHandle;
+#endif
+
+    DISTRHO_DECLARE_NON_COPYABLE(PublisherSemaphore)
+};
+
+class TuningPublisher;
+
+/**
+   The one thread in the process that sends tunings for every instance with Publish From Thread on.
+   It sleeps on a semaphore until an instance hands over a table or switches the mode, so nothing wakes it while the
+   mode is off, or while the tuning isn't changing. After a send it waits kPeriodUs before looking again, which caps
+   the rate, and whatever was handed over in the meantime goes out in a single send.
+ */
+class TuningPublisherThread
+{
+public:
+    // The thread is started with its first user and stopped when the last user goes away
+    static TuningPublisherThread* retain()
+    {
+        std::lock_guard<std::mutex> lock(instanceMutex());
+        TuningPublisherThread*& thread(instance());
+
+        if (thread == nullptr)
+            thread = new TuningPublisherThread();
+
+        ++thread->fUsers;
+        return thread;
+    }
+
+    static void release()
+    {
+        std::lock_guard<std::mutex> lock(instanceMutex());
+        TuningPublisherThread*& thread(instance());
+
+        if (thread != nullptr && --thread->fUsers == 0)
+        {
+            delete thread;
+            thread = nullptr;
+        }
+    }
+
+    void add(TuningPublisher* publisher)
+    {
+        std::lock_guard<std::mutex> lock(fMutex);
+        fPublishers.push_back(publisher);
+    }
+
+    // Once this returns, the thread is done with @a publisher
+    void remove(TuningPublisher* publisher)
+    {
+        std::lock_guard<std::mutex> lock(fMutex);
+        fPublishers.erase(std::remove(fPublishers.begin(), fPublishers.end(), publisher), fPublishers.end());
+    }
+
+    // Audio thread side
+    void wake() noexcept
+    {
+        fWake.post();
+    }
+
+    enum {
+        // Shortest time between two sends
+        kPeriodUs = 1000
+    };
+
+private:
+    TuningPublisherThread()
+        : fUsers(0),
+          fExit(false)
+    {
+        fThread = std::thread(&TuningPublisherThread::process, this);
+    }
+
+    ~TuningPublisherThread()
+    {
+        {
+            std::lock_guard<std::mutex> lock(fMutex);
+            fExit = true;
+        }
+        fWake.post();
+        fThread.join();
+    }
+
+    static std::mutex& instanceMutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static TuningPublisherThread*& instance()
+    {
+        static TuningPublisherThread* thread = nullptr;
+        return thread;
+    }
+
+    // Above normal threads, so sends aren't held up when the machine is busy. Without the rights to, it stays normal.
+    static void raisePriority() noexcept
+    {
+#ifdef DISTRHO_OS_WINDOWS
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+#else
+        sched_param param;
+        std::memset(&param, 0, sizeof(param));
+        param.sched_priority = sched_get_priority_min(SCHED_FIFO) + 1;
+        pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+#endif
+    }
+
+    inline void process();
+
+    uint32_t fUsers;
+
+    std::mutex fMutex;
+    std::vector<TuningPublisher*> fPublishers;
+    bool fExit;
+
+    PublisherSemaphore fWake;
+    std::thread fThread;
+
+    DISTRHO_DECLARE_NON_COPYABLE(TuningPublisherThread)
+};
+
+/**
+   One instance's share of the publisher thread. run() hands over the newest table through a triple buffer and wakes
+   the thread, which sends it straight away, or kPeriodUs after its last send at the latest. The worst wait seen
+   lately is reported by latencyMs(). Under SCHED_FIFO that stays close to the period.
+
+   The instance is served between activate() and deactivate(). It only counts as active once the thread has seen the
+   mode switched on, and stops counting as active once the thread has finished its last send, so run() and the
+   thread never both send at the same time.
+ */
+class TuningPublisher
+{
+public:
+    TuningPublisher()
+        : fEnabled(false),
+          fActive(false),
+          fLatencyMs(0.0f),
+          fThread(nullptr),
+          fValid(false),
+          fWorst(0.0f)
+    {
+        std::memset(fPublished, 0, sizeof(fPublished));
+    }
+
+    ~TuningPublisher()
+    {
+        stop();
+    }
+
+    void start()
+    {
+        if (fThread != nullptr)
+            return;
+
+        fThread = TuningPublisherThread::retain();
+        fThread->add(this);
+        fThread->wake();
+    }
+
+    void stop()
+    {
+        if (fThread == nullptr)
+            return;
+
+        fThread->remove(this);
+        fThread = nullptr;
+        TuningPublisherThread::release();
+
+        fActive.store(false, std::memory_order_release);
+    }
+
+    /* Audio thread side */
+
+    void setEnabled(bool enabled) noexcept
+    {
+        if (fEnabled.exchange(enabled, std::memory_order_relaxed) != enabled && fThread != nullptr)
+            fThread->wake();
+    }
+
+    // Whether the thread is doing the sending, rather than run()
+    bool isActive() const noexcept
+    {
+        return fActive.load(std::memory_order_acquire);
+    }
+
+    void write(const double* frequencies, bool resend) noexcept
+    {
+        TuningSnapshot& snapshot(fSnapshots.writeBuffer());
+        std::memcpy(snapshot.frequencies, frequencies, sizeof(snapshot.frequencies));
+        snapshot.resend = resend;
+        snapshot.written = std::chrono::steady_clock::now();
+        fSnapshots.publish();
+
+        if (fThread != nullptr)
+            fThread->wake();
+    }
+
+    // Longest a table has waited to be sent over the last kLatencyWindowMs
+    float latencyMs() const noexcept
+    {
+        return fLatencyMs.load(std::memory_order_relaxed);
+    }
+
+private:
+    friend class TuningPublisherThread;
+
+    enum {
+        kLatencyWindowMs = 250
+    };
+
+    // Thread side: follow the mode and send the newest table, if there is one. Returns true if anything was sent.
+    bool service(std::chrono::steady_clock::time_point now)
+    {
+        if (! fEnabled.load(std::memory_order_relaxed))
+        {
+            if (fActive.load(std::memory_order_relaxed))
+            {
+                fValid = false;
+                fLatencyMs.store(0.0f, std::memory_order_relaxed);
+                fActive.store(false, std::memory_order_release);
+            }
+            return false;
+        }
+
+        if (! fActive.load(std::memory_order_relaxed))
+        {
+            // Anything left over from before was meant for run() to send
+            fSnapshots.acquire();
+            fWorst = 0.0f;
+            fWindowStart = now;
+            fActive.store(true, std::memory_order_release);
+            return false;
+        }
+
+        if (now - fWindowStart >= std::chrono::milliseconds(kLatencyWindowMs))
+        {
+            fLatencyMs.store(fWorst, std::memory_order_relaxed);
+            fWorst = 0.0f;
+            fWindowStart = now;
+        }
+
+        if (! fSnapshots.acquire())
+            return false;
+
+        const TuningSnapshot& snapshot(fSnapshots.readBuffer());
+        if (snapshot.resend)
+            fValid = false;
+
+        sendTuning(snapshot.frequencies, fPublished, fValid);
+
+        fWorst = std::max(fWorst, std::chrono::duration<float, std::milli>(now - snapshot.written).count());
+        return true;
+    }
+
+    std::atomic<bool> fEnabled;
+    std::atomic<bool> fActive;
+    std::atomic<float> fLatencyMs;
+
+    TuningPublisherThread* fThread;
+    TripleBuffer<TuningSnapshot> fSnapshots;
+
+    // What the thread last sent, and the worst wait since fWindowStart, only touched by the thread
+    double fPublished[kMidiNoteCount];
+    bool fValid;
+    float fWorst;
+    std::chrono::steady_clock::time_point fWindowStart;
+
+    DISTRHO_DECLARE_NON_COPYABLE(TuningPublisher)
+};
+
+inline void TuningPublisherThread::process()
+{
+    raisePriority();
+
+    for (;;)
+    {
+        fWake.wait();
+        fWake.drain();
+
+        bool sent = false;
+        {
+            std::lock_guard<std::mutex> lock(fMutex);
+            if (fExit)
+                return;
+
+            const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            for (TuningPublisher* publisher : fPublishers)
+                sent |= publisher->service(now);
+        }
+
+        // Tables handed over in the meantime wait, and only the newest of each goes out
+        if (sent)
+            std::this_thread::sleep_for(std::chrono::microseconds(kPeriodUs));
+    }
+}
+
+END_NAMESPACE_DISTRHO
+
+#endif
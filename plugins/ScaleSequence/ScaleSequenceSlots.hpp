@@ -0,0 +1,320 @@
+#ifndef SCALESEQUENCE_SLOTS_HPP
+#define SCALESEQUENCE_SLOTS_HPP
+
+#include <atomic>
+#include <mutex>
+#include <string>
+
+#include "extra/String.hpp"
+#include "ScaleSequenceArena.hpp"
+#include "ScaleSequenceParser.hpp"
+#include "ScaleSequenceTuning.hpp"
+
+START_NAMESPACE_DISTRHO
+
+static const int32_t kScaleSlotCount = 4;
+
+/**
+   Lock-free triple buffer with a single writer and a single reader.
+   The writer fills writeBuffer() and publishes it, the reader picks up the newest published buffer with acquire().
+   Neither side ever waits for the other.
+ */
+template <class T>
+class TripleBuffer
+{
+public:
+    TripleBuffer()
+        : fMiddle(1),
+          fBack(2),
+          fFront(0) {}
+
+    T& writeBuffer() noexcept
+    {
+        return fBuffers[fBack];
+    }
+
+    void publish() noexcept
+    {
+        fBack = fMiddle.exchange(fBack | kFresh, std::memory_order_acq_rel) & kIndexMask;
+    }
+
+    // Returns true if a newer buffer has been swapped in since the last call
+    bool acquire() noexcept
+    {
+        if ((fMiddle.load(std::memory_order_relaxed) & kFresh) == 0)
+            return false;
+
+        fFront = fMiddle.exchange(fFront, std::memory_order_acq_rel) & kIndexMask;
+        return true;
+    }
+
+    const T& readBuffer() const noexcept
+    {
+        return fBuffers[fFront];
+    }
+
+    // Not thread safe, only for use before the reader has started
+    void fill(const T& value) noexcept
+    {
+        for (int32_t i = 0; i < 3; i++)
+            fBuffers[i] = value;
+    }
+
+private:
+    static const uint8_t kIndexMask = 0x3;
+    static const uint8_t kFresh = 0x4;
+
+    T fBuffers[3];
+    std::atomic<uint8_t> fMiddle;
+    uint8_t fBack;
+    uint8_t fFront;
+};
+
+/**
+   One of the four scales. Holds the SCL/KBM files chosen for the slot and the table baked from them.
+   Files are only parsed when load() is called, so slots that the sequence never reaches cost nothing.
+   Nothing parsed is kept between loads: each load reads both files again and keeps only the baked table.
+ */
+class ScaleSlot
+{
+public:
+    ScaleSlot()
+        : fKeepOnError(false),
+          fGeneration(0),
+          fDirty(false),
+          fRequested(false),
+          fPublishedMask(nullptr),
+          fPublishedBit(0)
+    {
+        fTable.fill(defaultScaleTable());
+        fBaked = defaultScaleTable();
+    }
+
+    // Have @a bit set in @a mask every time a new table is published, so the reader can skip idle slots
+    void notifyOnPublish(std::atomic<uint32_t>* mask, uint32_t bit) noexcept
+    {
+        fPublishedMask = mask;
+        fPublishedBit = bit;
+    }
+
+    void setSclFile(const char* value)
+    {
+        std::lock_guard<std::mutex> lock(fMutex);
+        fSclFile = value;
+        fKeepOnError = false;
+        fDirty.store(true);
+    }
+
+    void setKbmFile(const char* value)
+    {
+        std::lock_guard<std::mutex> lock(fMutex);
+        fKbmFile = value;
+        fKeepOnError = false;
+        fDirty.store(true);
+    }
+
+    // The files were edited on disk. If the edit doesn't parse, the slot keeps the table it already has.
+    void reload()
+    {
+        std::lock_guard<std::mutex> lock(fMutex);
+        if (! fDirty.load())
+            fKeepOnError = true;
+        fDirty.store(true);
+    }
+
+    void getFiles(std::string& scl, std::string& kbm)
+    {
+        std::lock_guard<std::mutex> lock(fMutex);
+        scl = fSclFile;
+        kbm = fKbmFile;
+    }
+
+    // Copy of the table most recently published, for work derived from it off the audio thread
+    void copyBaked(ScaleTable& table)
+    {
+        std::lock_guard<std::mutex> lock(fMutex);
+        table = fBaked;
+    }
+
+    // Parse the slot's files and publish the new table. Returns true if a new table was published.
+    bool load()
+    {
+        std::lock_guard<std::mutex> lock(fMutex);
+
+        if (! fDirty.load())
+            return false;
+
+        // File contents and parse results all come from this arena and are freed together when the load is done.
+        // Small files never leave the stack buffer.
+        alignas(std::max_align_t) char initial[kArenaInitialSize];
+        MonotonicArena arena(initial, sizeof(initial));
+
+        ScaleData scale;
+        MappingData mapping;
+        bool hasScale = false, hasMapping = false;
+
+        const bool ok = loadScl(arena, scale, hasScale) && loadKbm(arena, mapping, hasMapping)
+                        && bake(hasScale ? &scale : nullptr, hasMapping ? &mapping : nullptr);
+
+        if (ok or ! fKeepOnError)
+        {
+            // As before, a bad file resets the slot to both the standard tuning and mapping
+            if (! ok)
+                fTable.writeBuffer() = defaultScaleTable();
+
+            fTable.writeBuffer().generation = ++fGeneration;
+            fBaked = fTable.writeBuffer();
+            fTable.publish();
+
+            if (fPublishedMask != nullptr)
+                fPublishedMask->fetch_or(fPublishedBit, std::memory_order_release);
+        }
+        else
+        {
+            d_stdout("ScaleSequence:Keeping the previous tuning");
+        }
+
+        const bool published = ok or ! fKeepOnError;
+
+        fKeepOnError = false;
+        fRequested.store(false);
+        fDirty.store(false);
+
+        return published;
+    }
+
+    bool isDirty() const noexcept
+    {
+        return fDirty.load(std::memory_order_relaxed);
+    }
+
+    bool isRequested() const noexcept
+    {
+        return fRequested.load(std::memory_order_relaxed);
+    }
+
+    /* Audio thread side */
+
+    // Ask the loader to give this slot priority, because a step has selected it
+    void request() noexcept
+    {
+        fRequested.store(true, std::memory_order_relaxed);
+    }
+
+    bool acquire() noexcept
+    {
+        return fTable.acquire();
+    }
+
+    const ScaleTable& table() const noexcept
+    {
+        return fTable.readBuffer();
+    }
+
+private:
+    static const size_t kArenaInitialSize = 8192;
+
+    // These return false if the file is an .scl/.kbm file that could not be read
+    bool loadScl(MonotonicArena& arena, ScaleData& scale, bool& hasScale) const
+    {
+        String filename(fSclFile.c_str());
+
+        if (! filename.endsWith(".scl"))
+            return true;
+
+        TextView contents;
+        ParseResult result = { kParseCannotRead, 0 };
+        if (readFileContents(fSclFile.c_str(), arena, contents))
+            result = parseScl(contents.begin, static_cast<size_t>(contents.end - contents.begin), arena, scale);
+
+        if (! result.ok())
+        {
+            logError(fSclFile, result);
+            return false;
+        }
+
+        hasScale = true;
+        return true;
+    }
+
+    bool loadKbm(MonotonicArena& arena, MappingData& mapping, bool& hasMapping) const
+    {
+        String filename(fKbmFile.c_str());
+
+        if (! filename.endsWith(".kbm"))
+            return true;
+
+        TextView contents;
+        ParseResult result = { kParseCannotRead, 0 };
+        if (readFileContents(fKbmFile.c_str(), arena, contents))
+            result = parseKbm(contents.begin, static_cast<size_t>(contents.end - contents.begin), arena, mapping);
+
+        if (! result.ok())
+        {
+            logError(fKbmFile, result);
+            return false;
+        }
+
+        hasMapping = true;
+        return true;
+    }
+
+    // The Tuning only exists for as long as it takes to fill the table
+    bool bake(const ScaleData* scale, const MappingData* mapping)
+    {
+        if (scale == nullptr && mapping == nullptr)
+        {
+            fTable.writeBuffer() = defaultScaleTable();
+            return true;
+        }
+
+        try
+        {
+            Tunings::Scale s(defaultTuning().scale);
+            Tunings::KeyboardMapping k(defaultTuning().keyboardMapping);
+
+            if (scale != nullptr)
+            {
+                toTuningScale(*scale, s);
+                s.name = fSclFile;
+            }
+            if (mapping != nullptr)
+            {
+                toTuningMapping(*mapping, k);
+                k.name = fKbmFile;
+            }
+
+            const Tunings::Tuning tn(s, k);
+            bakeScaleTable(fTable.writeBuffer(), tn);
+            return true;
+        }
+        catch (const std::exception& e)
+        {
+            d_stdout("ScaleSequence:Exception when setting tuning");
+            d_stdout(e.what());
+            return false;
+        }
+    }
+
+    static void logError(const std::string& filename, const ParseResult& result)
+    {
+        d_stdout("ScaleSequence:Error when setting tuning from %s: %s (line %d)",
+                 filename.c_str(), parseStatusText(result.status), result.line);
+    }
+
+    std::mutex fMutex;
+    std::string fSclFile, fKbmFile;
+    bool fKeepOnError;
+    uint32_t fGeneration;
+    ScaleTable fBaked;
+
+    std::atomic<bool> fDirty;
+    std::atomic<bool> fRequested;
+    TripleBuffer<ScaleTable> fTable;
+    std::atomic<uint32_t>* fPublishedMask;
+    uint32_t fPublishedBit;
+};
+
+END_NAMESPACE_DISTRHO
+
+#endif
@@ -0,0 +1,375 @@
+#ifndef SCALESEQUENCE_STEPS_HPP
+#define SCALESEQUENCE_STEPS_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "DistrhoUtils.hpp"
+#include "ScaleSequenceControls.hpp"
+#include "ScaleSequenceParser.hpp"
+
+START_NAMESPACE_DISTRHO
+
+enum {
+    // Longest sequence a pattern can hold
+    kMaxSteps = 64,
+    // Patterns in the bank, selected with kParameterPattern. Pattern 0 is always the Step 1..16 parameters.
+    kPatternCount = 8,
+    // Steps driven by the Step 1..16 parameters
+    kParameterStepCount = kParameterStep16 - kParameterStep1 + 1,
+    // Note lengths are counted in 1/192 of a whole note, which holds triplets down to 1/64
+    kNoteResolution = 192,
+    // Choices of the Glide Sync parameter
+    kGlideSyncCount = 7
+};
+
+// Units of a step's glide length
+enum GlideUnit {
+    kGlideMilliseconds = 0,
+    // Fractions of a whole note (kNoteResolution per note), timed from the host tempo
+    kGlideNotes        = 1
+};
+
+// Glide Sync choices as fractions of a whole note, 0 being off
+static const double kGlideSyncNotes[kGlideSyncCount] = {
+    0.0, 1.0 / 32.0, 1.0 / 16.0, 1.0 / 8.0, 1.0 / 4.0, 1.0 / 2.0, 1.0
+};
+
+static const char* const kGlideSyncLabels[kGlideSyncCount] = {
+    "Off", "1/32", "1/16", "1/8", "1/4", "1/2", "1/1"
+};
+
+// How a glide moves from the old tuning to the new one
+enum StepCurve {
+    // One-pole approach, the original Scale Glide behaviour
+    kCurveExponential = 0,
+    kCurveLinear      = 1,
+    // Smoothstep, slow at both ends
+    kCurveSmooth      = 2
+};
+
+/**
+   Per-step glide settings, packed into 8 bytes.
+   A glide length of 0 follows the Glide Sync or Scale Glide parameters. The multiplier scales every frequency of the
+   step's scale.
+ */
+struct StepAttributes
+{
+    uint16_t glideLength;
+    uint8_t curve;
+    uint8_t glideUnit;
+    float multiplier;
+};
+
+/**
+   One sequence of steps, indexed directly by the step number.
+   Each step holds the slot it selects (1..4), or 0 to keep whatever scale the previous step left.
+ */
+struct StepPattern
+{
+    uint8_t length;
+    uint8_t scales[kMaxSteps];
+    StepAttributes attributes[kMaxSteps];
+
+    bool references(int32_t slot) const noexcept
+    {
+        for (int32_t i = 0; i < length; i++)
+            if (scales[i] == slot + 1)
+                return true;
+        return false;
+    }
+};
+
+/**
+   The patterns stored in the "step_patterns" state. An empty pattern falls back to the step parameters.
+ */
+struct StepBank
+{
+    StepPattern patterns[kPatternCount];
+};
+
+/**
+   What happens when the sequence reaches one step, worked out in advance for the step coming from the one before it.
+   Held steps (scale 0) already carry the scale they inherit.
+ */
+struct Transition
+{
+    int32_t scale;
+    int32_t curve;
+    // Length in whole notes of a glide that follows the tempo, or 0. Its samples are worked out when it starts.
+    double notes;
+    // Length of the glide, or 0 for an open-ended one-pole glide
+    uint32_t samples;
+    // One-pole coefficient for the exponential curve, progress per sample for the others
+    double coefficient;
+    double multiplier;
+    // Steps without a glide length of their own take it from Glide Sync or Scale Glide when the glide starts
+    bool followsGlide;
+};
+
+/**
+   A pattern compiled for the current sample rate, so stepping is a lookup.
+   Glide Sync and Scale Glide are left out, so automating them doesn't call for a new plan.
+ */
+struct TransitionPlan
+{
+    int32_t length;
+    Transition transitions[kMaxSteps];
+
+    // Returns nullptr for steps outside the pattern, such as the negative ones before the offset
+    const Transition* at(int32_t step) const noexcept
+    {
+        return step >= 0 && step < length ? &transitions[step] : nullptr;
+    }
+};
+
+/**
+   Every pattern of the bank compiled, so switching patterns is only picking another plan.
+   An empty plan falls back to the step parameters, like its pattern.
+ */
+struct TransitionPlanBank
+{
+    TransitionPlan plans[kPatternCount];
+};
+
+inline void resetStepPattern(StepPattern& pattern) noexcept
+{
+    std::memset(&pattern, 0, sizeof(pattern));
+
+    for (int32_t i = 0; i < kMaxSteps; i++)
+    {
+        pattern.attributes[i].curve = kCurveExponential;
+        pattern.attributes[i].multiplier = 1.0f;
+    }
+}
+
+/**
+   Fill @a pattern from the Step 1..16 parameters, with the loop point as its length.
+   Attributes are left alone. Returns true if anything changed.
+ */
+inline bool stepPatternFromParameters(StepPattern& pattern, const float* params) noexcept
+{
+    const float loopPoint = limit(params[kParameterLoopPoint],
+                                  controlLimits[kParameterLoopPoint].first, controlLimits[kParameterLoopPoint].second);
+    bool changed = false;
+
+    const uint8_t length = static_cast<uint8_t>(loopPoint);
+    changed |= pattern.length != length;
+    pattern.length = length;
+
+    for (int32_t i = 0; i < kParameterStepCount; i++)
+    {
+        const uint8_t scale = static_cast<uint8_t>(params[kParameterStep1 + i]);
+        changed |= pattern.scales[i] != scale;
+        pattern.scales[i] = scale;
+    }
+
+    return changed;
+}
+
+// Set a glide to last @a samples
+inline void timeTransition(Transition& transition, double samples) noexcept
+{
+    samples = std::max(1.0, std::round(samples));
+    transition.samples = static_cast<uint32_t>(samples);
+
+    // The one-pole is within e^-5 of the target when the time is up, and then snaps
+    transition.coefficient = transition.curve == kCurveExponential ? 1.0 - std::exp(-5.0 / samples) : 1.0 / samples;
+}
+
+/**
+   Compile @a pattern into @a plan. Only steps with a glide length in milliseconds are timed here, the others are
+   timed when their glide starts.
+ */
+inline void compileTransitionPlan(TransitionPlan& plan, const StepPattern& pattern, double sampleRate) noexcept
+{
+    plan.length = pattern.length;
+
+    // Held steps take the last scale set before them, going round the loop if needed
+    uint8_t held = 0;
+    for (int32_t i = pattern.length - 1; i >= 0 && held == 0; i--)
+        held = pattern.scales[i];
+
+    for (int32_t i = 0; i < pattern.length; i++)
+    {
+        const StepAttributes& attributes(pattern.attributes[i]);
+        Transition& transition(plan.transitions[i]);
+
+        if (pattern.scales[i] != 0)
+            held = pattern.scales[i];
+
+        transition.scale = held;
+        transition.curve = attributes.curve;
+        transition.multiplier = attributes.multiplier;
+        transition.notes = 0.0;
+        transition.samples = 0;
+        transition.coefficient = 0.0;
+        transition.followsGlide = attributes.glideLength == 0;
+
+        if (attributes.glideLength != 0 && attributes.glideUnit == kGlideMilliseconds)
+            timeTransition(transition, attributes.glideLength * 0.001 * sampleRate);
+        else if (attributes.glideLength != 0)
+            // Timed from the tempo when the glide starts
+            transition.notes = static_cast<double>(attributes.glideLength) / kNoteResolution;
+    }
+}
+
+inline void compileTransitionPlanBank(TransitionPlanBank& plans, const StepBank& bank, double sampleRate) noexcept
+{
+    for (int32_t i = 0; i < kPatternCount; i++)
+        compileTransitionPlan(plans.plans[i], bank.patterns[i], sampleRate);
+}
+
+/**
+   Give a step that follows the glide parameters its length: @a syncNotes whole notes if that is not 0, or else
+   @a glide, the Scale Glide parameter. A length in notes is timed from the tempo when the glide starts.
+ */
+inline void followGlideSettings(Transition& transition, double glide, double syncNotes) noexcept
+{
+    if (! transition.followsGlide)
+        return;
+
+    if (syncNotes > 0.0)
+    {
+        transition.notes = syncNotes;
+        return;
+    }
+
+    // Scale Glide is the one-pole's time constant in thousands of samples
+    transition.notes = 0.0;
+    transition.samples = transition.curve == kCurveExponential ? 0 : static_cast<uint32_t>(glide * 1000.0);
+    transition.coefficient = 1.0 / (glide * 1000.0);
+}
+
+// Reads the optional "(glide length, curve, multiplier)" after a step digit
+inline bool parseStepAttributes(TextView v, StepAttributes& attributes) noexcept
+{
+    TextView fields[3] = {};
+    int32_t count = 0;
+
+    const char* start = v.begin;
+    for (const char* p = v.begin;; ++p)
+    {
+        if (p == v.end || *p == ',')
+        {
+            if (count == 3)
+                return false;
+            fields[count].begin = start;
+            fields[count].end = p;
+            fields[count] = trimmed(fields[count]);
+            ++count;
+            start = p + 1;
+        }
+        if (p == v.end)
+            break;
+    }
+
+    if (contains(fields[0], '/'))
+    {
+        // A note length such as "1/8", counted in kNoteResolution steps per whole note
+        const char* slash = fields[0].begin;
+        while (*slash != '/')
+            ++slash;
+
+        const TextView nv = { fields[0].begin, slash };
+        const TextView dv = { slash + 1, fields[0].end };
+        int64_t n, d;
+        if (! parseInteger(nv, n) || ! parseInteger(dv, d) || n <= 0 || d <= 0 || n > UINT16_MAX
+            || n * kNoteResolution % d != 0
+            || n * kNoteResolution / d > UINT16_MAX)
+            return false;
+
+        attributes.glideLength = static_cast<uint16_t>(n * kNoteResolution / d);
+        attributes.glideUnit = kGlideNotes;
+    }
+    else if (! fields[0].empty())
+    {
+        int64_t glideMs;
+        if (! parseInteger(fields[0], glideMs) || glideMs < 0 || glideMs > UINT16_MAX)
+            return false;
+        attributes.glideLength = static_cast<uint16_t>(glideMs);
+        attributes.glideUnit = kGlideMilliseconds;
+    }
+
+    if (! fields[1].empty())
+    {
+        if (fields[1].end - fields[1].begin != 1)
+            return false;
+
+        switch (*fields[1].begin)
+        {
+        case 'e': attributes.curve = kCurveExponential; break;
+        case 'l': attributes.curve = kCurveLinear; break;
+        case 's': attributes.curve = kCurveSmooth; break;
+        default: return false;
+        }
+    }
+
+    if (! fields[2].empty())
+    {
+        double multiplier;
+        if (! parseDecimal(fields[2], multiplier) || ! (multiplier > 0.0 && multiplier <= 16.0))
+            return false;
+        attributes.multiplier = static_cast<float>(multiplier);
+    }
+
+    return true;
+}
+
+/**
+   Parse the bank from its state text: one pattern per ';' separated field, one digit (0..4) per step.
+   A step may be followed by its attributes in brackets, any of which can be left out: "2(250,l,1.5)" glides to scale 2
+   over 250 ms on a straight line, with every frequency multiplied by 1.5, "1(1/8)" glides for an eighth note at the
+   host tempo and "3(,s)" only changes the curve.
+   Whitespace is ignored, so "1234 1234; 11223344" is two patterns of eight steps.
+   Returns false and leaves @a bank untouched if the text is malformed.
+ */
+inline bool parseStepBank(const char* text, StepBank& bank) noexcept
+{
+    StepBank parsed;
+    for (int32_t i = 0; i < kPatternCount; i++)
+        resetStepPattern(parsed.patterns[i]);
+
+    int32_t pattern = 0;
+
+    for (const char* c = text; *c != '\0'; ++c)
+    {
+        if (isBlank(*c))
+            continue;
+
+        if (*c == ';')
+        {
+            if (++pattern == kPatternCount)
+                return false;
+            continue;
+        }
+
+        StepPattern& p(parsed.patterns[pattern]);
+
+        if (*c == '(')
+        {
+            const char* const close = std::strchr(c, ')');
+            const TextView fields = { c + 1, close };
+
+            if (p.length == 0 || close == nullptr || ! parseStepAttributes(fields, p.attributes[p.length - 1]))
+                return false;
+
+            c = close;
+            continue;
+        }
+
+        if (*c < '0' || *c > '4' || p.length == kMaxSteps)
+            return false;
+
+        p.scales[p.length++] = static_cast<uint8_t>(*c - '0');
+    }
+
+    bank = parsed;
+    return true;
+}
+
+END_NAMESPACE_DISTRHO
+
+#endif
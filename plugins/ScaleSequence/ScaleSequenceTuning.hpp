@@ -0,0 +1,128 @@
+#ifndef SCALESEQUENCE_TUNING_HPP
+#define SCALESEQUENCE_TUNING_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "DistrhoUtils.hpp"
+#include "Tunings.h"
+
+START_NAMESPACE_DISTRHO
+
+static const int32_t kMidiNoteCount = 128;
+
+// Frequencies for every MIDI note of one slot, baked from its tuning
+struct ScaleTable
+{
+    double frequencies[kMidiNoteCount];
+    // The same frequencies as log2(Hz), for gliding in pitch
+    double log2Frequencies[kMidiNoteCount];
+    // Counts the slot's loads, so tables derived from this one can tell if they are still current
+    uint32_t generation;
+};
+
+inline void bakeScaleTable(ScaleTable& table, const Tunings::Tuning& tn)
+{
+    for (int32_t i = 0; i < kMidiNoteCount; i++)
+    {
+        table.frequencies[i] = tn.frequencyForMidiNote(i);
+        table.log2Frequencies[i] = std::log2(table.frequencies[i]);
+    }
+}
+
+/**
+   2^x for the pitch glide, accurate to about 1e-8 (a hundred-thousandth of a cent).
+   Only adds, multiplies and integer shifts, so loops over whole tables vectorise.
+ */
+inline double fastExp2(double x) noexcept
+{
+    // Adding 1.5 * 2^52 rounds to the nearest integer and leaves it in the low bits of the mantissa
+    static const double kRoundShift = 6755399441055744.0;
+
+    const double shifted = x + kRoundShift;
+    const double n = shifted - kRoundShift;
+    const double f = x - n;
+
+    // Taylor series of 2^f, f in [-0.5, 0.5]
+    double p = 1.5252733804059838e-05;
+    p = p * f + 0.00015403530393381606;
+    p = p * f + 0.0013333558146428441;
+    p = p * f + 0.0096181291076284769;
+    p = p * f + 0.055504108664821576;
+    p = p * f + 0.24022650695910069;
+    p = p * f + 0.69314718055994529;
+    p = p * f + 1.0;
+
+    int64_t shiftedBits, shiftBits;
+    std::memcpy(&shiftedBits, &shifted, sizeof(shiftedBits));
+    std::memcpy(&shiftBits, &kRoundShift, sizeof(shiftBits));
+
+    const int64_t scaleBits = (shiftedBits - shiftBits + 1023) << 52;
+    double scale;
+    std::memcpy(&scale, &scaleBits, sizeof(scale));
+
+    return p * scale;
+}
+
+enum {
+    // Most frames between exact frequencies in the pitch glide. With the exp2 work spread over 64 frames, a frame of
+    // the pitch glide costs 0.7 to 1.3 times a frame of the Hz glide, depending on the compiler flags (see the
+    // glide benchmark). At 16 it was about twice.
+    kPitchSegmentFrames = 64
+};
+
+/**
+   One frame of the Hz glide over a whole table: every note @a remaining of its starting difference short of its target.
+ */
+inline void glideFrameHz(double* frequencies, const double* targets, const double* deltas, double remaining) noexcept
+{
+    for (int32_t i = 0; i < kMidiNoteCount; i++)
+        frequencies[i] = targets[i] - deltas[i] * remaining;
+}
+
+/**
+   The first frame of a segment of the pitch glide: exact frequencies @a remaining of the difference in octaves short of
+   the targets, and the ratio per frame that moves each note on by @a step of its difference.
+ */
+inline void glidePitchSegment(double* frequencies, double* ratios, const double* log2Targets, const double* deltas,
+                              double remaining, double step) noexcept
+{
+    for (int32_t i = 0; i < kMidiNoteCount; i++)
+    {
+        frequencies[i] = fastExp2(log2Targets[i] - deltas[i] * remaining);
+        ratios[i] = fastExp2(deltas[i] * step);
+    }
+}
+
+// The other frames of a segment cost a multiply per note
+inline void glidePitchFrame(double* frequencies, const double* ratios) noexcept
+{
+    for (int32_t i = 0; i < kMidiNoteCount; i++)
+        frequencies[i] *= ratios[i];
+}
+
+/**
+   Standard tuning (12-TET with the standard mapping), shared by every DSP and UI instance in the process.
+   It is built the first time it is asked for and never changes, so new instances only copy from it.
+ */
+inline const Tunings::Tuning& defaultTuning()
+{
+    static const Tunings::Tuning tuning;
+    return tuning;
+}
+
+inline const ScaleTable& defaultScaleTable()
+{
+    static const ScaleTable table = [] {
+        ScaleTable t;
+        bakeScaleTable(t, defaultTuning());
+        t.generation = 0;
+        return t;
+    }();
+    return table;
+}
+
+END_NAMESPACE_DISTRHO
+
+#endif
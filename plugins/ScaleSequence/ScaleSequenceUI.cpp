@@ -14,6 +14,7 @@
  * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <memory>
 #include <string>
 #include "DistrhoUI.hpp"
 #include "ResizeHandle.hpp"
@@ -22,7 +23,7 @@
 #include "BrunoAceFont.hpp"
 #include "BrunoAceSCFont.hpp"
 #include "LektonRegularFont.hpp"
-#include "Tunings.h"
+#include "ScaleSequenceTuning.hpp"
 
 START_NAMESPACE_DISTRHO
 
@@ -35,6 +36,7 @@ const char* kStateKeys[kStateCount] = {
     "kbm_file_2",
     "kbm_file_3",
     "kbm_file_4",
+    "step_patterns",
 };
 
 // --------------------------------------------------------------------------------------------------------------------
@@ -70,13 +72,15 @@ public:
 			fFileBaseName[i] = d;
 		}
 		
- 		utuning1 = Tunings::Tuning(); 
-		utuning2 = Tunings::Tuning(); 
-		utuning3 = Tunings::Tuning(); 
-		utuning4 = Tunings::Tuning(); 
-		
 		ui_multiplier = static_cast<int>(ParameterDefaults[kParameterMultiplier]);
 		ui_loopPoint = static_cast<int>(ParameterDefaults[kParameterLoopPoint]);
+		ui_pattern = static_cast<int>(ParameterDefaults[kParameterPattern]);
+		ui_pitchGlide = ParameterDefaults[kParameterPitchGlide] > 0.5f;
+		ui_glideAhead = ParameterDefaults[kParameterGlideAhead] > 0.5f;
+		ui_snapOnJump = ParameterDefaults[kParameterSnapOnJump] > 0.5f;
+		ui_heldNotesOnly = ParameterDefaults[kParameterHeldNotesOnly] > 0.5f;
+		ui_retuneOnNoteOn = ParameterDefaults[kParameterRetuneOnNoteOn] > 0.5f;
+		ui_publishFromThread = ParameterDefaults[kParameterPublishFromThread] > 0.5f;
 		
         // account for scaling
         scale_factor = getScaleFactor();
@@ -192,6 +196,27 @@ protected:
         case kParameterLoopPoint:
             ui_loopPoint = static_cast<int>(fParameters[kParameterLoopPoint]);
             break;
+        case kParameterPattern:
+            ui_pattern = static_cast<int>(fParameters[kParameterPattern]);
+            break;
+        case kParameterPitchGlide:
+            ui_pitchGlide = fParameters[kParameterPitchGlide] > 0.5f;
+            break;
+        case kParameterGlideAhead:
+            ui_glideAhead = fParameters[kParameterGlideAhead] > 0.5f;
+            break;
+        case kParameterSnapOnJump:
+            ui_snapOnJump = fParameters[kParameterSnapOnJump] > 0.5f;
+            break;
+        case kParameterHeldNotesOnly:
+            ui_heldNotesOnly = fParameters[kParameterHeldNotesOnly] > 0.5f;
+            break;
+        case kParameterRetuneOnNoteOn:
+            ui_retuneOnNoteOn = fParameters[kParameterRetuneOnNoteOn] > 0.5f;
+            break;
+        case kParameterPublishFromThread:
+            ui_publishFromThread = fParameters[kParameterPublishFromThread] > 0.5f;
+            break;
 		
         default:
             break;
@@ -232,58 +257,40 @@ protected:
         
         // NOTE: We will mirror what's happening on the DSP side
 
-        if (stateId == 0)
-		{	
-			checkScl(utuning1, value, stateId);
-		}
-		else if (stateId == 1)
-		{
-			checkScl(utuning2, value, stateId);
-		}
-		else if (stateId == 2)
-		{
-			checkScl(utuning3, value, stateId);
-		}	
-		else if (stateId == 3)
-		{	
-			checkScl(utuning4, value, stateId);
-		}		
-		else if (stateId == 4)
-		{
-			checkKbm(utuning1, value, stateId);
-		}
-		else if (stateId == 5)
+        if (stateId <= kStateFileSCL4)
 		{
-			checkKbm(utuning2, value, stateId);
+			checkScl(utunings[stateId], value, stateId);
 		}
-		else if (stateId == 6)
-		{
-			checkKbm(utuning3, value, stateId);
-		}
-		else if (stateId == 7)
+		else
 		{
-			checkKbm(utuning4, value, stateId);
+			checkKbm(utunings[stateId - kStateFileKBM1], value, stateId);
 		}
 	    
         repaint();
     }
     
-    void checkScl(Tunings::Tuning & tn, const char* value, const States & stateId)
+    // A null tuning stands for the shared standard tuning, so nothing is built until a file is chosen
+    static const Tunings::Tuning& tuningOrDefault(const std::unique_ptr<Tunings::Tuning>& tn)
+    {
+        return tn ? *tn : defaultTuning();
+    }
+    
+    void checkScl(std::unique_ptr<Tunings::Tuning> & tn, const char* value, const States & stateId)
     {
 		String filename(value);
-		auto k = tn.keyboardMapping;
+		auto k = tuningOrDefault(tn).keyboardMapping;
 		
 		if (filename.endsWith(".scl"))
 		{
 			try
 			{   auto s = Tunings::readSCLFile(value);
-				tn = Tunings::Tuning(s, k);
-                const char *a = tn.scale.name.c_str();
+				tn.reset(new Tunings::Tuning(s, k));
+                const char *a = tn->scale.name.c_str();
                 fFileBaseName[stateId] = getFileBaseName(a);
 			}
 			catch (const std::exception& e)
 			{
-				tn = Tunings::Tuning();
+				tn.reset();
 				String noScl("Standard SCL tuning");
                 String noKbm("Standard KBM mapping");
                 fFileBaseName[stateId] = noScl;
@@ -299,8 +306,12 @@ protected:
 		}
 		else
 		{
-			auto s = Tunings::Tuning().scale;
-			tn = Tunings::Tuning(s, k);
+			// Nothing to rebuild if the mapping is standard as well
+			if (tn)
+			{
+				auto s = defaultTuning().scale;
+				tn.reset(new Tunings::Tuning(s, k));
+			}
 			String noScl("Standard SCL tuning");
 			fFileBaseName[stateId] = noScl;
 			
@@ -313,22 +324,22 @@ protected:
 		}
 	}
 	
-	void checkKbm(Tunings::Tuning & tn, const char* value, const States & stateId)
+	void checkKbm(std::unique_ptr<Tunings::Tuning> & tn, const char* value, const States & stateId)
 	{
 		String filename(value);
-		auto s = tn.scale;
+		auto s = tuningOrDefault(tn).scale;
 		if (filename.endsWith(".kbm"))
 		{
 			try
 			{
 				auto k = Tunings::readKBMFile(value);
-				tn = Tunings::Tuning(s, k);
-				const char *a = tn.keyboardMapping.name.c_str();
+				tn.reset(new Tunings::Tuning(s, k));
+				const char *a = tn->keyboardMapping.name.c_str();
                 fFileBaseName[stateId] = getFileBaseName(a);
 			}
 			catch (const std::exception& e)
 			{
-				tn = Tunings::Tuning();
+				tn.reset();
 				String noScl("Standard SCL tuning");
                 String noKbm("Standard KBM mapping");
                 fFileBaseName[stateId - 4] = noScl;
@@ -344,8 +355,12 @@ protected:
 		}
 		else
 		{
-			auto k = Tunings::Tuning().keyboardMapping;
-			tn = Tunings::Tuning(s, k);
+			// Nothing to rebuild if the scale is standard as well
+			if (tn)
+			{
+				auto k = defaultTuning().keyboardMapping;
+				tn.reset(new Tunings::Tuning(s, k));
+			}
 			String noKbm("Standard KBM mapping");
 			fFileBaseName[stateId] = noKbm;
 			
@@ -1148,6 +1163,21 @@ protected:
                 editParameter(kParameterLoopPoint, false);
             }
             
+            // Pattern, 0 plays the steps above
+            if (ImGui::SliderInt("Pattern", &ui_pattern, static_cast<int>(controlLimits[kParameterPattern].first), static_cast<int>(controlLimits[kParameterPattern].second)))
+            {
+                if (ImGui::IsItemActivated())
+                    editParameter(kParameterPattern, true);
+                
+                fParameters[kParameterPattern] = static_cast<float>(ui_pattern);
+                setParameterValue(kParameterPattern, fParameters[kParameterPattern]);
+            }
+			
+			 if (ImGui::IsItemDeactivated())
+            {
+                editParameter(kParameterPattern, false);
+            }
+            
 			ImGui::EndChild(); // bottom left pane
 			
 			ImGui::SameLine();
@@ -1252,6 +1282,153 @@ protected:
             {
                 editParameter(kParameterOffset, false);
             }
+            
+            // Pitch Glide, glide evenly in cents rather than in Hz
+            if (ImGui::Checkbox("Pitch Glide", &ui_pitchGlide))
+            {
+                editParameter(kParameterPitchGlide, true);
+                fParameters[kParameterPitchGlide] = ui_pitchGlide ? 1.0f : 0.0f;
+                setParameterValue(kParameterPitchGlide, fParameters[kParameterPitchGlide]);
+                editParameter(kParameterPitchGlide, false);
+            }
+            
+            // Held Notes Only, glide the notes held at the MIDI input and move the rest straight to the new tuning
+            if (ImGui::Checkbox("Held Notes Only", &ui_heldNotesOnly))
+            {
+                editParameter(kParameterHeldNotesOnly, true);
+                fParameters[kParameterHeldNotesOnly] = ui_heldNotesOnly ? 1.0f : 0.0f;
+                setParameterValue(kParameterHeldNotesOnly, fParameters[kParameterHeldNotesOnly]);
+                editParameter(kParameterHeldNotesOnly, false);
+            }
+            
+            // Retune On Note On, only send a new tuning when a note starts
+            if (ImGui::Checkbox("Retune On Note On", &ui_retuneOnNoteOn))
+            {
+                editParameter(kParameterRetuneOnNoteOn, true);
+                fParameters[kParameterRetuneOnNoteOn] = ui_retuneOnNoteOn ? 1.0f : 0.0f;
+                setParameterValue(kParameterRetuneOnNoteOn, fParameters[kParameterRetuneOnNoteOn]);
+                editParameter(kParameterRetuneOnNoteOn, false);
+            }
+            
+            // Publish Threshold, how far a glide moves before the tuning is sent again
+            if (ImGui::SliderFloat("Publish Threshold", &fParameters[kParameterPublishThreshold], controlLimits[kParameterPublishThreshold].first, controlLimits[kParameterPublishThreshold].second, "%.2f cents", ImGuiSliderFlags_NoInput))
+            {
+                if (ImGui::IsItemActivated())
+                    editParameter(kParameterPublishThreshold, true);
+
+                setParameterValue(kParameterPublishThreshold, fParameters[kParameterPublishThreshold]);
+            }
+
+            if (ImGui::IsItemDeactivated())
+            {
+                editParameter(kParameterPublishThreshold, false);
+            }
+            
+            // Publish From Thread, send the tuning from a thread of its own rather than the audio thread
+            if (ImGui::Checkbox("Publish From Thread", &ui_publishFromThread))
+            {
+                editParameter(kParameterPublishFromThread, true);
+                fParameters[kParameterPublishFromThread] = ui_publishFromThread ? 1.0f : 0.0f;
+                setParameterValue(kParameterPublishFromThread, fParameters[kParameterPublishFromThread]);
+                editParameter(kParameterPublishFromThread, false);
+            }
+            
+            if (ui_publishFromThread)
+            {
+                ImGui::SameLine();
+                ImGui::Text("%.2f ms", fParameters[kParameterPublishLatency]);
+            }
+            
+            // Glide Sync, glide for a note length at the host tempo
+            const char* glide_sync_types[7] = { "Off", "1/32", "1/16", "1/8", "1/4", "1/2", "1/1" };
+            const char* current_glide_sync = glide_sync_types[static_cast<int32_t>(fParameters[kParameterGlideSync])];
+            
+            if (ImGui::BeginCombo("Glide Sync", current_glide_sync))
+            {
+                if (ImGui::IsItemActivated())
+                        editParameter(kParameterGlideSync, true);
+                        
+                for (int n = 0; n < IM_ARRAYSIZE(glide_sync_types); n++)
+                {
+                    bool is_selected = (current_glide_sync == glide_sync_types[n]);
+                    if (ImGui::Selectable(glide_sync_types[n], is_selected))
+                    {
+                        current_glide_sync = glide_sync_types[n];
+                        fParameters[kParameterGlideSync] = static_cast<float>(n);
+                        setParameterValue(kParameterGlideSync, fParameters[kParameterGlideSync]);
+                    }
+                    if (is_selected)
+                        ImGui::SetItemDefaultFocus();
+                }
+                ImGui::EndCombo();
+            }
+            
+            if (ImGui::IsItemDeactivated())
+            {
+                editParameter(kParameterGlideSync, false);
+            }
+            
+            // Glide Ahead, start gliding early so the tuning arrives on the step
+            if (ImGui::Checkbox("Glide Ahead", &ui_glideAhead))
+            {
+                editParameter(kParameterGlideAhead, true);
+                fParameters[kParameterGlideAhead] = ui_glideAhead ? 1.0f : 0.0f;
+                setParameterValue(kParameterGlideAhead, fParameters[kParameterGlideAhead]);
+                editParameter(kParameterGlideAhead, false);
+            }
+            
+            // Snap On Jump, skip the glide when the host jumps to another position
+            if (ImGui::Checkbox("Snap On Jump", &ui_snapOnJump))
+            {
+                editParameter(kParameterSnapOnJump, true);
+                fParameters[kParameterSnapOnJump] = ui_snapOnJump ? 1.0f : 0.0f;
+                setParameterValue(kParameterSnapOnJump, fParameters[kParameterSnapOnJump]);
+                editParameter(kParameterSnapOnJump, false);
+            }
+            
+            // Clock Source: the host's transport, a MIDI clock, or the Tempo parameter counted from activation (Internal)
+            // or from the host's frame while it plays (Internal (Host Frame))
+            const char* clock_sources[4] = { "Host", "MIDI Clock", "Internal", "Internal (Host Frame)" };
+            const char* current_clock_source = clock_sources[static_cast<int32_t>(fParameters[kParameterClockSource])];
+            
+            if (ImGui::BeginCombo("Clock Source", current_clock_source))
+            {
+                if (ImGui::IsItemActivated())
+                        editParameter(kParameterClockSource, true);
+                        
+                for (int n = 0; n < IM_ARRAYSIZE(clock_sources); n++)
+                {
+                    bool is_selected = (current_clock_source == clock_sources[n]);
+                    if (ImGui::Selectable(clock_sources[n], is_selected))
+                    {
+                        current_clock_source = clock_sources[n];
+                        fParameters[kParameterClockSource] = static_cast<float>(n);
+                        setParameterValue(kParameterClockSource, fParameters[kParameterClockSource]);
+                    }
+                    if (is_selected)
+                        ImGui::SetItemDefaultFocus();
+                }
+                ImGui::EndCombo();
+            }
+            
+            if (ImGui::IsItemDeactivated())
+            {
+                editParameter(kParameterClockSource, false);
+            }
+            
+            // Tempo of the internal clock
+            if (ImGui::SliderFloat("Tempo", &fParameters[kParameterTempo], controlLimits[kParameterTempo].first, controlLimits[kParameterTempo].second, "%.1f BPM", ImGuiSliderFlags_NoInput))
+            {
+                if (ImGui::IsItemActivated())
+                    editParameter(kParameterTempo, true);
+
+                setParameterValue(kParameterTempo, fParameters[kParameterTempo]);
+            }
+
+            if (ImGui::IsItemDeactivated())
+            {
+                editParameter(kParameterTempo, false);
+            }
 			
 			ImGui::EndChild(); // bottom right pane
 			
@@ -1283,7 +1460,7 @@ private:
     String fState[kStateCount];
     String fFileBaseName[kStateCount];
     
-    Tunings::Tuning utuning1, utuning2, utuning3, utuning4;
+    std::unique_ptr<Tunings::Tuning> utunings[4];
     
     // UI stuff
     double scale_factor;
@@ -1300,6 +1477,13 @@ private:
     // int and bool variables required for Dear ImGui SliderInt and CheckBox widgets.
     int ui_multiplier;
 	int ui_loopPoint;
+	int ui_pattern;
+	bool ui_pitchGlide;
+	bool ui_glideAhead;
+	bool ui_snapOnJump;
+	bool ui_heldNotesOnly;
+	bool ui_retuneOnNoteOn;
+	bool ui_publishFromThread;
     
 
     
@@ -0,0 +1,471 @@
+#ifndef SCALESEQUENCE_WATCHER_HPP
+#define SCALESEQUENCE_WATCHER_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "DistrhoUtils.hpp"
+
+#ifdef DISTRHO_OS_LINUX
+# include <poll.h>
+# include <sys/eventfd.h>
+# include <sys/inotify.h>
+# include <unistd.h>
+#endif
+
+START_NAMESPACE_DISTRHO
+
+/**
+   Watches the SCL/KBM files of every loaded slot in the process and reloads a slot when one of its files is saved.
+   On Linux the directories holding the files are watched with inotify, elsewhere (or if inotify is unavailable)
+   the files are polled. Saves are debounced, so an editor writing a file in several steps causes a single reload.
+   The thread only runs while there is something to watch, and with inotify it sleeps until a file changes or a
+   reload is due.
+
+   The callback only queues the reload on the loader pool, and ScaleSlot::reload() makes sure a bad edit keeps
+   the previous table.
+ */
+class ScaleFileWatcher
+{
+public:
+    typedef void (*ReloadCallback)(void* owner, int32_t slot);
+
+    static ScaleFileWatcher* retain()
+    {
+        std::lock_guard<std::mutex> lock(instanceMutex());
+        ScaleFileWatcher*& watcher(instance());
+
+        if (watcher == nullptr)
+            watcher = new ScaleFileWatcher();
+
+        ++watcher->fUsers;
+        return watcher;
+    }
+
+    static void release()
+    {
+        std::lock_guard<std::mutex> lock(instanceMutex());
+        ScaleFileWatcher*& watcher(instance());
+
+        if (watcher != nullptr && --watcher->fUsers == 0)
+        {
+            delete watcher;
+            watcher = nullptr;
+        }
+    }
+
+    // Start (or stop, if both files are empty) watching the files of one slot
+    void watch(void* owner, int32_t slot, ReloadCallback callback, const std::string& scl, const std::string& kbm)
+    {
+        std::lock_guard<std::mutex> lock(fMutex);
+
+        for (auto it = fEntries.begin(); it != fEntries.end(); ++it)
+        {
+            if (it->owner == owner && it->slot == slot)
+            {
+                fEntries.erase(it);
+                break;
+            }
+        }
+
+        if (! scl.empty() || ! kbm.empty())
+        {
+            Entry entry;
+            entry.owner = owner;
+            entry.slot = slot;
+            entry.callback = callback;
+            entry.files[0] = absolutePath(scl);
+            entry.files[1] = absolutePath(kbm);
+            entry.stamps[0] = stampOf(entry.files[0]);
+            entry.stamps[1] = stampOf(entry.files[1]);
+            entry.pending = false;
+            entry.polled = false;
+            fEntries.push_back(entry);
+
+            // A thread that ran out of files to watch has already finished, so joining it doesn't wait
+            if (! fRunning)
+            {
+                if (fThread.joinable())
+                    fThread.join();
+
+                fRunning = true;
+                fThread = std::thread(&ScaleFileWatcher::process, this);
+            }
+        }
+
+        fWatchesChanged = true;
+        wake();
+    }
+
+    // Stop watching every slot of @a owner. No callback for it runs after this returns.
+    void unwatch(const void* owner)
+    {
+        std::lock_guard<std::mutex> lock(fMutex);
+
+        for (auto it = fEntries.begin(); it != fEntries.end();)
+        {
+            if (it->owner == owner)
+                it = fEntries.erase(it);
+            else
+                ++it;
+        }
+
+        fWatchesChanged = true;
+        wake();
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    enum {
+        // Quiet time after the last change before the slot is reloaded
+        kDebounceMs = 250,
+        // How often files are checked when inotify is not available, or their directory cannot be watched
+        kPollIntervalMs = 500
+    };
+
+    struct FileStamp
+    {
+        int64_t mtime;
+        int64_t size;
+
+        bool operator!=(const FileStamp& other) const noexcept
+        {
+            return mtime != other.mtime || size != other.size;
+        }
+    };
+
+    struct Entry
+    {
+        void* owner;
+        int32_t slot;
+        ReloadCallback callback;
+        std::string files[2];
+        FileStamp stamps[2];
+        Clock::time_point due;
+        bool pending;
+        // Checked by polling, as inotify could not watch the directory of one of the files
+        bool polled;
+    };
+
+    ScaleFileWatcher()
+        : fUsers(0),
+          fExit(false),
+          fRunning(false),
+          fWatchesChanged(false)
+    {
+#ifdef DISTRHO_OS_LINUX
+        fWake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
+    }
+
+    ~ScaleFileWatcher()
+    {
+        {
+            std::lock_guard<std::mutex> lock(fMutex);
+            fExit = true;
+            wake();
+        }
+
+        if (fThread.joinable())
+            fThread.join();
+
+#ifdef DISTRHO_OS_LINUX
+        if (fWake >= 0)
+            ::close(fWake);
+#endif
+    }
+
+    static std::mutex& instanceMutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static ScaleFileWatcher*& instance()
+    {
+        static ScaleFileWatcher* watcher = nullptr;
+        return watcher;
+    }
+
+    static FileStamp stampOf(const std::string& file)
+    {
+        FileStamp stamp = { -1, -1 };
+        struct stat st;
+
+        if (! file.empty() && ::stat(file.c_str(), &st) == 0)
+        {
+            stamp.mtime = static_cast<int64_t>(st.st_mtime);
+            stamp.size = static_cast<int64_t>(st.st_size);
+        }
+        return stamp;
+    }
+
+    // inotify needs the directory, so relative paths are resolved against the host's working directory
+    static std::string absolutePath(const std::string& file)
+    {
+#ifdef DISTRHO_OS_LINUX
+        char resolved[PATH_MAX];
+
+        if (file.empty() || ::realpath(file.c_str(), resolved) != nullptr)
+            return file.empty() ? file : std::string(resolved);
+
+        // Not there yet, but it may be saved later
+        if (file[0] != '/' && ::getcwd(resolved, sizeof(resolved)) != nullptr)
+            return std::string(resolved) + "/" + file;
+#endif
+        return file;
+    }
+
+    static std::string directoryOf(const std::string& file)
+    {
+        const size_t pos = file.find_last_of('/');
+        if (pos == std::string::npos)
+            return std::string();
+        return pos == 0 ? std::string("/") : file.substr(0, pos);
+    }
+
+    // Get the thread to look at the entries again. Called with the lock held.
+    void wake()
+    {
+#ifdef DISTRHO_OS_LINUX
+        if (fWake >= 0)
+        {
+            const uint64_t one = 1;
+            const ssize_t written = ::write(fWake, &one, sizeof(one));
+            (void)written;
+        }
+#endif
+        fCondition.notify_all();
+    }
+
+    // Only reload once the file has stopped changing for a while
+    void touch(Entry& entry)
+    {
+        entry.pending = true;
+        entry.due = Clock::now() + std::chrono::milliseconds(kDebounceMs);
+    }
+
+    void fireDueReloads()
+    {
+        const Clock::time_point now = Clock::now();
+
+        for (Entry& entry : fEntries)
+        {
+            if (entry.pending && entry.due <= now)
+            {
+                entry.pending = false;
+                entry.stamps[0] = stampOf(entry.files[0]);
+                entry.stamps[1] = stampOf(entry.files[1]);
+                entry.callback(entry.owner, entry.slot);
+            }
+        }
+    }
+
+    void pollFiles(bool onlyUnwatched)
+    {
+        for (Entry& entry : fEntries)
+        {
+            if (onlyUnwatched && ! entry.polled)
+                continue;
+
+            for (int32_t i = 0; i < 2; i++)
+            {
+                const FileStamp stamp = stampOf(entry.files[i]);
+                if (stamp != entry.stamps[i])
+                {
+                    entry.stamps[i] = stamp;
+                    touch(entry);
+                }
+            }
+        }
+    }
+
+#ifdef DISTRHO_OS_LINUX
+    // Watch the directories rather than the files, so editors that save by renaming a new file are seen too
+    void updateWatches(int fd)
+    {
+        if (! fWatchesChanged)
+            return;
+        fWatchesChanged = false;
+
+        std::map<std::string, int> watches;
+
+        for (Entry& entry : fEntries)
+        {
+            entry.polled = false;
+
+            for (int32_t i = 0; i < 2; i++)
+            {
+                if (entry.files[i].empty())
+                    continue;
+
+                // A file without a directory to watch falls back to polling
+                const std::string dir = directoryOf(entry.files[i]);
+                if (dir.empty())
+                {
+                    entry.polled = true;
+                    continue;
+                }
+                if (watches.count(dir) != 0)
+                    continue;
+
+                const auto existing = fWatches.find(dir);
+                if (existing != fWatches.end())
+                {
+                    watches[dir] = existing->second;
+                    fWatches.erase(existing);
+                    continue;
+                }
+
+                const int wd = inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+                if (wd >= 0)
+                    watches[dir] = wd;
+                else
+                    entry.polled = true;
+            }
+        }
+
+        for (const auto& unused : fWatches)
+            inotify_rm_watch(fd, unused.second);
+
+        fWatches.swap(watches);
+    }
+
+    // Block until a reload is due, or for as long as it takes to see changes to polled files, or else for good
+    int pollTimeout() const
+    {
+        const Clock::time_point now = Clock::now();
+        int timeout = -1;
+
+        for (const Entry& entry : fEntries)
+        {
+            if (entry.polled)
+                timeout = timeout < 0 ? kPollIntervalMs : std::min<int>(timeout, kPollIntervalMs);
+
+            if (entry.pending)
+            {
+                const auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(entry.due - now).count() + 1;
+                const int due = static_cast<int>(std::max<decltype(wait)>(0, std::min<decltype(wait)>(wait, kDebounceMs)));
+                timeout = timeout < 0 ? due : std::min(timeout, due);
+            }
+        }
+
+        return timeout;
+    }
+
+    void handleEvents(int fd)
+    {
+        alignas(struct inotify_event) char buffer[4096];
+
+        for (;;)
+        {
+            const ssize_t length = ::read(fd, buffer, sizeof(buffer));
+            if (length <= 0)
+                break;
+
+            for (ssize_t pos = 0; pos < length;)
+            {
+                const struct inotify_event* const event = reinterpret_cast<const struct inotify_event*>(buffer + pos);
+                pos += static_cast<ssize_t>(sizeof(struct inotify_event) + event->len);
+
+                if (event->len == 0)
+                    continue;
+
+                for (const auto& watch : fWatches)
+                {
+                    if (watch.second != event->wd)
+                        continue;
+
+                    const std::string path = (watch.first == "/" ? std::string() : watch.first) + "/" + event->name;
+                    for (Entry& entry : fEntries)
+                        if (entry.files[0] == path || entry.files[1] == path)
+                            touch(entry);
+                }
+            }
+        }
+    }
+#endif
+
+    void process()
+    {
+#ifdef DISTRHO_OS_LINUX
+        const int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#else
+        const int fd = -1;
+#endif
+
+        std::unique_lock<std::mutex> lock(fMutex);
+
+        while (! fExit && ! fEntries.empty())
+        {
+#ifdef DISTRHO_OS_LINUX
+            if (fd >= 0 && fWake >= 0)
+            {
+                updateWatches(fd);
+                pollFiles(true);
+                fireDueReloads();
+                const int timeout = pollTimeout();
+                lock.unlock();
+
+                struct pollfd pfds[2] = { { fd, POLLIN, 0 }, { fWake, POLLIN, 0 } };
+                const int ready = ::poll(pfds, 2, timeout);
+
+                lock.lock();
+                if (ready > 0 && (pfds[1].revents & POLLIN) != 0)
+                {
+                    uint64_t count;
+                    const ssize_t length = ::read(fWake, &count, sizeof(count));
+                    (void)length;
+                }
+                if (ready > 0 && (pfds[0].revents & POLLIN) != 0)
+                    handleEvents(fd);
+                continue;
+            }
+#endif
+            pollFiles(false);
+            fireDueReloads();
+            fCondition.wait_for(lock, std::chrono::milliseconds(kPollIntervalMs));
+        }
+
+        // With nothing left to watch the thread ends, and the next watch() starts another
+        fRunning = false;
+        fWatches.clear();
+        fWatchesChanged = true;
+        lock.unlock();
+
+#ifdef DISTRHO_OS_LINUX
+        if (fd >= 0)
+            ::close(fd);
+#endif
+    }
+
+    uint32_t fUsers;
+    bool fExit;
+    bool fRunning;
+    bool fWatchesChanged;
+#ifdef DISTRHO_OS_LINUX
+    // Wakes the thread from poll() when the entries change or it has to exit
+    int fWake;
+#endif
+
+    std::mutex fMutex;
+    std::condition_variable fCondition;
+    std::thread fThread;
+    std::vector<Entry> fEntries;
+    std::map<std::string, int> fWatches;
+};
+
+END_NAMESPACE_DISTRHO
+
+#endif